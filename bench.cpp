@@ -0,0 +1,954 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "spaces.h"
+#include "copying.h"
+#include "gen.h"
+#include "marksweep.h"
+#include "wordscan.h"
+#include "image.h"
+#include "wire.h"
+#include "shared.h"
+#include "shard.h"
+#include "intern.h"
+#include "region.h"
+
+#include <iostream>
+#include <iomanip>
+
+// Benchmarks, built by "make bench" with optimisation on and tracing
+// compiled out.  "./bench" runs them all; "./bench <name> [args]"
+// runs one.
+
+static double now_ms() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+static unsigned rnd(unsigned &seed) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// A random graph of n pairs: each one is a cons cell (when its dr is
+// a seq) or a _pr (when not), over two subgraphs of random sizes, and
+// now and then a subgraph built earlier is shared instead.  Unlike a
+// plain list it branches everywhere, which is what lets several
+// markers make progress at once.
+static core::handle_t random_graph(core::Space &s, size_t n, unsigned &seed,
+                                   core::handle_t *shared, size_t nshared) {
+    if (n == 0)
+        return rnd(seed) & 1 ? s.null() : s.cons(core::FixInt(0), s.null());
+    if (n <= 64 && rnd(seed) % 16 == 0)
+        return shared[rnd(seed) % nshared];
+    size_t left = rnd(seed) % n;
+    core::handle_t a = random_graph(s, left, seed, shared, nshared);
+    core::handle_t d = random_graph(s, n - 1 - left, seed, shared, nshared);
+    core::handle_t g = s.cons(a, d);
+    shared[rnd(seed) % nshared] = g;
+    return g;
+}
+
+// Mark a large random graph with 1..N threads; prints the best of a
+// few full collections at each thread count.
+static void bench_mark(size_t nodes, size_t max_threads) {
+    spaces::MarkSweepSpace s(spaces::Policy(32 * 1024, 4 * 1024, 1 << 16));
+    unsigned seed = 1;
+    const size_t nshared = 64;
+    std::vector<core::handle_t> shared(nshared, s.null());
+    core::handle_t g = random_graph(s, nodes, seed, &shared[0], nshared);
+
+    std::cout << "mark: " << nodes << " pairs, "
+              << s.pages_in_use() << " pages\n";
+    double base = 0;
+    for (size_t t = 1; t <= max_threads; t++) {
+        s.set_mark_threads(t);
+        double best = 0;
+        for (int rep = 0; rep < 5; rep++) {
+            double t0 = now_ms();
+            s.collect();
+            double ms = now_ms() - t0;
+            if (rep == 0 || ms < best)
+                best = ms;
+        }
+        if (t == 1)
+            base = best;
+        std::cout << std::setw(4) << t << " threads: "
+                  << std::fixed << std::setprecision(2) << std::setw(9) << best
+                  << " ms  x" << base / best << "\n";
+    }
+}
+
+// Allocate garbage beside a large live graph, stopping the world to
+// collect and then marking incrementally with a slice budget; prints
+// the longest pause of each.
+static void bench_pause(size_t nodes, double slice_ms) {
+    for (int incremental = 0; incremental < 2; incremental++) {
+        spaces::MarkSweepSpace s(spaces::Policy(32 * 1024, 4 * 1024, 16));
+        if (incremental)
+            s.set_incremental(slice_ms);
+        unsigned seed = 1;
+        const size_t nshared = 64;
+        std::vector<core::handle_t> shared(nshared, s.null());
+        core::handle_t g = random_graph(s, nodes, seed, &shared[0], nshared);
+        core::handle_t l = s.null();
+        double t0 = now_ms();
+        for (size_t i = 0; i < 8 * nodes; i++) {
+            l = s.cons(core::FixInt(i), l);
+            if (i % 64 == 0) {
+                g.pair_setcar(l); // keep the list, but churn the graph's root
+                l = s.null();
+            }
+        }
+        double total = now_ms() - t0;
+        std::cout << (incremental ? "incremental" : "   stopping")
+                  << ": " << s.collections() << " collections, "
+                  << s.slices() << " slices, max pause "
+                  << std::fixed << std::setprecision(3) << s.max_pause()
+                  << " ms, total " << total << " ms\n";
+    }
+}
+
+// Walk a long list, once through handles (every step links and
+// unlinks a handle in the space's chain) and once through Locals in a
+// HandleScope per step (a store to make one, a store to drop them).
+static void bench_walk(size_t length, int reps) {
+    spaces::BlockSpace s;
+    core::handle_t l = s.null();
+    for (size_t i = 0; i < length; i++)
+        l = s.cons(core::FixInt(i & 0xffff), l);
+
+    intptr_t sum = 0;
+    double t0 = now_ms();
+    for (int r = 0; r < reps; r++) {
+        core::handle_t h = l;
+        while (!h.is_null()) {
+            sum += h.seq_car().fixint_value();
+            h = h.seq_cdr();
+        }
+    }
+    double handles = now_ms() - t0;
+
+    intptr_t sum2 = 0;
+    t0 = now_ms();
+    for (int r = 0; r < reps; r++) {
+        core::HandleScope outer(s);
+        core::local_t v = s.local(l);
+        while (!v.is_null()) {
+            core::HandleScope step(s);
+            sum2 += v.seq_car().fixint_value();
+            v = v.seq_cdr();
+        }
+    }
+    double locals = now_ms() - t0;
+    assert(sum == sum2);
+
+    double steps = double(length) * reps;
+    std::cout << "walk: " << length << " x " << reps << "\n"
+              << std::fixed << std::setprecision(2)
+              << "  handles: " << std::setw(9) << handles << " ms  "
+              << 1e6 * handles / steps << " ns/step\n"
+              << "   locals: " << std::setw(9) << locals << " ms  "
+              << 1e6 * locals / steps << " ns/step\n";
+}
+
+// Build and walk a list in a copying space, holding it through
+// handles, and then as raw values in the conservative root mode.
+static void bench_roots(size_t length, int reps) {
+    intptr_t sums[2] = { 0, 0 };
+    for (int conservative = 0; conservative < 2; conservative++) {
+        spaces::CopySpace s(spaces::Policy(32 * 1024, 4 * 1024, 16));
+        double t0 = now_ms(), built, walked;
+        intptr_t &sum = sums[conservative];
+        if (!conservative) {
+            core::handle_t l = s.null();
+            for (size_t i = 0; i < length; i++)
+                l = s.cons(core::FixInt(i & 0xffff), l);
+            built = now_ms() - t0;
+            t0 = now_ms();
+            for (int r = 0; r < reps; r++)
+                for (core::handle_t h = l; !h.is_null(); h = h.seq_cdr())
+                    sum += h.seq_car().fixint_value();
+        } else {
+            s.set_conservative_roots(true);
+            core::tagged_t l = core::constants::Literal_null;
+            for (size_t i = 0; i < length; i++)
+                l = s.cons_raw(core::FixInt(i & 0xffff), l);
+            built = now_ms() - t0;
+            t0 = now_ms();
+            for (int r = 0; r < reps; r++)
+                for (core::tagged_t t = l; !t.is_null(); t = t.seq_cdr())
+                    sum += t.seq_car().fixint_value();
+        }
+        walked = now_ms() - t0;
+        std::cout << (conservative ? "conservative" : "     handles")
+                  << std::fixed << std::setprecision(2)
+                  << ": build " << 1e6 * built / length << " ns/cons, walk "
+                  << 1e6 * walked / (double(length) * reps) << " ns/step ("
+                  << s.collections() << " collections)\n";
+    }
+    assert(sums[0] == sums[1]);
+}
+
+// The same list built by cons and as one cdr-coded run: the words
+// each takes, and the time to walk it (through raw values, so that
+// the walk is not lost among handle updates).
+static void bench_runs(size_t length, int reps) {
+    std::vector<core::FixInt> vals;
+    for (size_t i = 0; i < length; i++)
+        vals.push_back(core::FixInt(i & 0xffff));
+    intptr_t sums[2] = { 0, 0 };
+    for (int coded = 0; coded < 2; coded++) {
+        spaces::CopySpace s(spaces::Policy(32 * 1024, 4 * 1024, 1 << 16));
+        core::handle_t l = s.null();
+        if (coded) {
+            l = s.list_from(vals.begin(), vals.end());
+        } else {
+            for (size_t i = length; i-- > 0; )
+                l = s.cons(vals[i], l);
+        }
+        double t0 = now_ms();
+        for (int r = 0; r < reps; r++)
+            for (core::tagged_t t = l.raw(); !t.is_null(); t = t.seq_cdr())
+                sums[coded] += t.seq_car().fixint_value();
+        double walked = now_ms() - t0;
+        std::cout << (coded ? "  run" : "conses") << ": "
+                  << s.words_in_use() << " words, walk "
+                  << std::fixed << std::setprecision(2)
+                  << 1e6 * walked / (double(length) * reps) << " ns/step\n";
+    }
+    assert(sums[0] == sums[1]);
+}
+
+// Many long lists, built a cell of each at a time (so that their
+// cells start out interleaved), then collected in each copy order and
+// walked with seq_cdr; the walk is slow wherever consecutive cells of
+// a list are far apart.
+static void bench_order(size_t length, size_t lists) {
+    spaces::CopySpace::Order orders[2] = {
+        spaces::CopySpace::breadth_first, spaces::CopySpace::cdr_first
+    };
+    for (int o = 0; o < 2; o++) {
+        spaces::CopySpace s(spaces::Policy(32 * 1024, 4 * 1024, 1 << 16));
+        s.set_copy_order(orders[o]);
+        std::vector<core::handle_t> heads(lists, s.null());
+        for (size_t i = 0; i < length / lists; i++)
+            for (size_t k = 0; k < lists; k++)
+                heads[k] = s.cons(core::FixInt(i & 0xffff), heads[k]);
+        core::handle_t all = s.null();
+        for (size_t k = 0; k < lists; k++)
+            all = s.cons(heads[k], all);
+        heads.clear();
+
+        double t0 = now_ms();
+        s.collect();
+        double gc = now_ms() - t0;
+
+        intptr_t sum = 0;
+        t0 = now_ms();
+        for (core::tagged_t a = all.raw(); !a.is_null(); a = a.seq_cdr())
+            for (core::tagged_t t = a.seq_car(); !t.is_null(); t = t.seq_cdr())
+                sum += t.seq_car().fixint_value();
+        double walked = now_ms() - t0;
+        std::cout << (o ? "    cdr-first" : "breadth-first") << ": collect "
+                  << std::fixed << std::setprecision(2) << gc << " ms, walk "
+                  << 1e6 * walked / length << " ns/step (sum " << sum << ")\n";
+    }
+}
+
+// Classify a random mix of fixnums, literals, conses and cells of a run
+// with the type tests, as an interpreter's dispatch on its operands
+// would.
+static void bench_dispatch(size_t n, int reps) {
+    spaces::BlockSpace s;
+    core::handle_t kons = s.cons(core::FixInt(1), s.null());
+    core::FixInt digits[] = { core::FixInt(1), core::FixInt(2) };
+    core::handle_t run = s.list_from(digits, digits + 2);
+    std::vector<core::tagged_t> words(n, core::constants::Literal_null);
+    unsigned seed = 1;
+    for (size_t i = 0; i < n; i++) {
+        switch (rnd(seed) % 6) {
+        case 0: case 1: words[i] = core::FixInt(i & 0xffff); break;
+        case 2: words[i] = core::constants::Literal_null; break;
+        case 3: words[i] = (i & 1) ? core::constants::Literal_true
+                                   : core::constants::Literal_false; break;
+        case 4: words[i] = kons.raw(); break;
+        case 5: words[i] = run.raw(); break;
+        }
+    }
+
+    intptr_t sum = 0;
+    size_t nulls = 0, seqs = 0, truths = 0;
+    double t0 = now_ms();
+    for (int r = 0; r < reps; r++) {
+        for (size_t i = 0; i < n; i++) {
+            core::tagged_t w = words[i];
+            if (w.is_fixint())
+                sum += w.fixint_value();
+            else if (w.is_null())
+                nulls++;
+            else if (w.is_seq())
+                seqs++;
+            else if (w.is_bool() && w.truth())
+                truths++;
+        }
+    }
+    double ms = now_ms() - t0;
+    std::cout << "dispatch: " << n << " x " << reps << ": "
+              << std::fixed << std::setprecision(2)
+              << 1e6 * ms / (double(n) * reps) << " ns/word (" << sum << ", "
+              << nulls << ", " << seqs << ", " << truths << ")\n";
+}
+
+// The nested switch that Word::variant_of was before its table.
+static core::Word::variant_t switch_variant(uintptr_t val) {
+    typedef core::Word W;
+    switch (val & 0x7) {
+    case 3: return W::snokref;
+    case 1: return W::konsref;
+    case 5: return W::valref;
+    case 7: return W::intrref;
+    case 2: case 6:
+        switch (val & 0x1f) {
+        case 0x0a:            return W::blobmdr;
+        case 0x06: case 0x16: return W::blobhdr;
+        case 0x02: case 0x12: return W::vechdr;
+        case 0x0e: case 0x1e: return W::bvlhdr;
+        default:              return W::literal;
+        }
+    default: return W::fixnum;
+    }
+}
+
+// Classify random words one at a time (by the old switch and by the
+// table), then find the references among mostly-fixnum words one at a
+// time and a span at a time; then mark-sweep collect a heap of long
+// runs of fixnums, whose tracing is that span scan.
+static void bench_classify(size_t n, int reps) {
+    std::vector<uintptr_t> words(n);
+    unsigned seed = 1;
+    for (size_t i = 0; i < n; i++)
+        words[i] = rnd(seed) * 8 + rnd(seed) % 32;
+    size_t hist[2][16] = { { 0 } };
+    double ms[2];
+    for (int table = 0; table < 2; table++) {
+        double t0 = now_ms();
+        for (int r = 0; r < reps; r++)
+            for (size_t i = 0; i < n; i++)
+                hist[table][table ? core::Word::variant_of(words[i])
+                                  : switch_variant(words[i])]++;
+        ms[table] = now_ms() - t0;
+    }
+    assert(memcmp(hist[0], hist[1], sizeof(hist[0])) == 0);
+    std::cout << std::fixed << std::setprecision(2)
+              << "classify: switch " << 1e6 * ms[0] / (double(n) * reps)
+              << " ns/word, table " << 1e6 * ms[1] / (double(n) * reps)
+              << " ns/word (" << hist[1][core::Word::fixnum] << " fixnums)\n";
+
+    for (size_t i = 0; i < n; i++)
+        words[i] = rnd(seed) % 16 ? core::FixInt(i & 0xffff).uint() : i * 8 + 1;
+    uintptr_t sums[2] = { 0, 0 };
+    for (int spans = 0; spans < 2; spans++) {
+        uintptr_t &sum = sums[spans];
+        double t0 = now_ms();
+        for (int r = 0; r < reps; r++) {
+            if (spans) {
+                core::each_ref(&words[0], n, [&sum](uintptr_t *p) { sum += *p; });
+            } else {
+                for (size_t i = 0; i < n; i++)
+                    if (words[i] & 0x1)
+                        sum += words[i];
+            }
+        }
+        ms[spans] = now_ms() - t0;
+    }
+    assert(sums[0] == sums[1]);
+    std::cout << "    refs: by word " << 1e6 * ms[0] / (double(n) * reps)
+              << " ns/word, by span " << 1e6 * ms[1] / (double(n) * reps)
+              << " ns/word (sum " << sums[1] << ")\n";
+
+    spaces::MarkSweepSpace s(spaces::Policy(32 * 1024, 4 * 1024, 1 << 16));
+    std::vector<core::FixInt> vals;
+    for (size_t i = 0; i < 1000; i++)
+        vals.push_back(core::FixInt(i));
+    core::handle_t all = s.null();
+    for (size_t k = 0; k < n / 1000; k++)
+        all = s.cons(s.list_from(vals.begin(), vals.end()), all);
+    double best = 0;
+    for (int r = 0; r < 5; r++) {
+        double t0 = now_ms();
+        s.collect();
+        double t = now_ms() - t0;
+        if (r == 0 || t < best)
+            best = t;
+    }
+    std::cout << "    mark: " << n / 1000 << " runs of 1000 fixnums, "
+              << best << " ms\n";
+}
+
+// Collect long runs that are held only by a reference to one of their
+// last cells, so that every collection resolves interior references
+// into long objects; then time allocating pairs alone, which now stops
+// at each card edge.
+static void bench_interior(size_t length, size_t count) {
+    spaces::CopySpace s(spaces::Policy(32 * 1024, 4 * 1024, 1 << 16));
+    std::vector<core::FixInt> vals;
+    for (size_t i = 0; i < length; i++)
+        vals.push_back(core::FixInt(i & 0xffff));
+    std::vector<core::handle_t> tails;
+    for (size_t k = 0; k < count; k++) {
+        core::handle_t t = s.list_from(vals.begin(), vals.end());
+        for (size_t i = 1; i < length; i++)
+            t = t.seq_cdr();
+        tails.push_back(t);
+    }
+    double best = 0;
+    for (int r = 0; r < 5; r++) {
+        double t0 = now_ms();
+        s.collect();
+        double t = now_ms() - t0;
+        if (r == 0 || t < best)
+            best = t;
+    }
+    std::cout << "interior: " << count << " runs of " << length << ", collect "
+              << std::fixed << std::setprecision(3) << best << " ms\n";
+
+    spaces::BlockSpace b;
+    double t0 = now_ms();
+    for (size_t i = 0; i < 10 * length * count; i++)
+        b.cons_raw(core::FixInt(i), core::constants::Literal_null);
+    std::cout << "    cons: " << 1e6 * (now_ms() - t0) / (10 * length * count)
+              << " ns/cons\n";
+}
+
+// Find the references of n records (in cache) by their layouts, one
+// crumb at a time and 32 at a time; then mark-sweep collect a heap of
+// 100n records, whose tracing is the latter.
+static void bench_records(size_t n, int reps) {
+    const size_t slots = 64;
+    core::Layout *l = core::Layout::make(slots);
+    unsigned seed = 1;
+    for (size_t i = 0; i < slots; i++)
+        l->set(i, core::Layout::Kind(rnd(seed) % 4));
+    std::vector<uintptr_t> words(n * slots);
+    for (size_t i = 0; i < words.size(); i++)
+        words[i] = rnd(seed) % 4 ? i * 8 + 1 : core::FixInt(i & 0xffff).uint();
+    uintptr_t sums[2] = { 0, 0 };
+    double ms[2];
+    for (int crumbs = 0; crumbs < 2; crumbs++) {
+        uintptr_t &sum = sums[crumbs];
+        double t0 = now_ms();
+        for (int r = 0; r < reps; r++)
+            for (size_t k = 0; k < n; k++) {
+                uintptr_t *s = &words[k * slots];
+                if (crumbs) {
+                    core::each_record_ref(s, l, 0, slots, [&sum](uintptr_t *p, bool u) {
+                        sum += u ? *p | 0x5 : *p;
+                    });
+                    continue;
+                }
+                for (size_t i = 0; i < slots; i++) {
+                    switch (l->describe(i)) {
+                    case core::Layout::tagged:
+                        if (s[i] & 0x1)
+                            sum += s[i];
+                        break;
+                    case core::Layout::closep:
+                        if (s[i])
+                            sum += s[i] | 0x5;
+                        break;
+                    default:
+                        break;
+                    }
+                }
+            }
+        ms[crumbs] = now_ms() - t0;
+    }
+    assert(sums[0] == sums[1]);
+    std::cout << std::fixed << std::setprecision(2)
+              << "records: by crumb " << 1e6 * ms[0] / (double(n) * slots * reps)
+              << " ns/slot, by word " << 1e6 * ms[1] / (double(n) * slots * reps)
+              << " ns/slot (sum " << sums[1] << ")\n";
+
+    spaces::MarkSweepSpace s(spaces::Policy(32 * 1024, 4 * 1024, 1 << 16));
+    core::handle_t shared = s.cons(core::FixInt(1), core::FixInt(2));
+    core::handle_t all = s.null();
+    for (size_t k = 0; k < 100 * n; k++) {
+        core::handle_t r = s.make_record(l);
+        for (size_t i = 0; i < slots; i++)
+            if (l->describe(i) == core::Layout::tagged ||
+                l->describe(i) == core::Layout::closep)
+                r.record_store(i, shared);
+        all = s.cons(r, all);
+    }
+    double best = 0;
+    for (int r = 0; r < 5; r++) {
+        double t0 = now_ms();
+        s.collect();
+        double t = now_ms() - t0;
+        if (r == 0 || t < best)
+            best = t;
+    }
+    std::cout << "    mark: " << 100 * n << " records of " << slots << " slots, "
+              << best << " ms\n";
+}
+
+// Collect a heap of count long runs (large objects, held by their
+// first cells) beside a short list; each run is one large vec.
+static void bench_large(size_t length, size_t count) {
+    spaces::CopySpace s;
+    std::vector<core::FixInt> vals;
+    for (size_t i = 0; i < length; i++)
+        vals.push_back(core::FixInt(i & 0xffff));
+    std::vector<core::handle_t> runs;
+    for (size_t k = 0; k < count; k++)
+        runs.push_back(s.list_from(vals.begin(), vals.end()));
+    core::handle_t small = s.null();
+    for (size_t i = 0; i < 10000; i++)
+        small = s.cons(core::FixInt(i), small);
+    double best = 0;
+    for (int r = 0; r < 5; r++) {
+        double t0 = now_ms();
+        s.collect();
+        double t = now_ms() - t0;
+        if (r == 0 || t < best)
+            best = t;
+    }
+    std::cout << "large: " << count << " runs of " << length << ", collect "
+              << std::fixed << std::setprecision(3) << best << " ms\n";
+}
+
+// Fill, copy and search a bvl's bytes a byte at a time through the
+// primops, then in bulk through its raw view; and sum a blob's raw
+// bytes as doubles, lane by lane.
+static void bench_raw(size_t n, int reps) {
+    spaces::CopySpace s;
+    core::handle_t a = s.make_bvl(core::headers::bvl, n);
+    core::handle_t b = s.make_bvl(core::headers::bvl, n);
+    core::handle_t d = s.make_blob(core::headers::blob, 0, core::FixInt(0), n);
+    size_t found = 0;
+    double t0 = now_ms();
+    for (int r = 0; r < reps; r++) {
+        for (size_t i = 0; i < n; i++)
+            a.bvl_set(i, uint8_t(r));
+        a.bvl_set(n - 1, 0xff);
+        for (size_t i = 0; i < n; i++)
+            b.bvl_set(i, a.bvl_get(i));
+        size_t i = 0;
+        while (i < n && b.bvl_get(i) != 0xff)
+            i++;
+        found += i;
+    }
+    double t1 = now_ms();
+    for (int r = 0; r < reps; r++) {
+        core::Bytes x = a.bvl_raw(), y = b.bvl_raw();
+        x.fill(0, n, uint8_t(r));
+        x.data()[n - 1] = 0xff;
+        y.copy(0, x, 0, n);
+        found += y.find(0xff);
+    }
+    double t2 = now_ms();
+    d.blob_raw().fill(0, n, 0);
+    double sum = 0;
+    for (int r = 0; r < reps; r++) {
+        core::Lanes<double> l = d.blob_raw().lanes<double>();
+        for (double v : l)
+            sum += v;
+    }
+    double t3 = now_ms();
+    std::cout << "raw: " << n << " bytes x " << reps
+              << ", per byte " << std::fixed << std::setprecision(3) << (t1 - t0)
+              << " ms, bulk " << (t2 - t1) << " ms, lane sum " << (t3 - t2)
+              << " ms (" << found + size_t(sum) << ")\n";
+}
+
+// Read a file into a bvl: into a native buffer and then byte by byte
+// through bvl_set, or straight into the bvl under a Pin.
+static void bench_pin(size_t n, int reps) {
+    FILE *f = tmpfile();
+    std::vector<uint8_t> src(n, 0x5a);
+    size_t put = f ? fwrite(src.data(), 1, n, f) : 0;
+    int err = f ? fflush(f) : EOF;
+    assert(put == n && err == 0);
+    int fd = fileno(f);
+    spaces::CopySpace s;
+    core::handle_t b = s.make_bvl(core::headers::bvl, n);
+    std::vector<uint8_t> tmp(n);
+    size_t got = 0;
+    double t0 = now_ms();
+    for (int r = 0; r < reps; r++) {
+        got += pread(fd, tmp.data(), n, 0);
+        for (size_t i = 0; i < n; i++)
+            b.bvl_set(i, tmp[i]);
+    }
+    double t1 = now_ms();
+    for (int r = 0; r < reps; r++) {
+        core::Pin pin(s, b);
+        got += pread(fd, pin.data(), pin.size(), 0);
+    }
+    double t2 = now_ms();
+    fclose(f);
+    std::cout << "pin: " << n << " bytes x " << reps
+              << ", copied in " << std::fixed << std::setprecision(3) << (t1 - t0)
+              << " ms, read in place " << (t2 - t1) << " ms (" << got << ")\n";
+}
+
+// Build a graph of n short lists (and a blob apiece) under one vec,
+// write it to an image, and compare building it again with loading
+// the image, and with loading it and then walking all of it.
+static void bench_image(size_t n, int reps) {
+    FILE *f = tmpfile();
+    double build = 0, load = 0, walk = 0;
+    for (int r = 0; r < reps; r++) {
+        spaces::CopySpace s;
+        double t0 = now_ms();
+        core::handle_t top = s.make_vec(core::headers::vec, n, core::FixInt(0));
+        for (size_t i = 0; i < n; i++) {
+            core::handle_t l = s.cons(s.make_blob(core::headers::blob, 1, core::FixInt(i), 64), s.null());
+            for (int k = 0; k < 8; k++)
+                l = s.cons(core::FixInt(k), l);
+            top.vec_store(i, l);
+        }
+        build += now_ms() - t0;
+        if (r == 0)
+            spaces::Image::write(fileno(f), &top, 1);
+    }
+    size_t sum = 0;
+    for (int r = 0; r < reps; r++) {
+        spaces::CopySpace s;
+        spaces::Image img(s);
+        double t0 = now_ms();
+        img.load(fileno(f));
+        core::handle_t top = img.root(0);
+        sum += top.vec_fetch(n / 2).seq_car().fixint_value();
+        double t1 = now_ms();
+        for (size_t i = 0; i < n; i++)
+            sum += top.vec_fetch(i).seq_cdr().seq_car().fixint_value();
+        load += t1 - t0;
+        walk += now_ms() - t1;
+    }
+    fclose(f);
+    std::cout << "image: " << n << " lists, build " << std::fixed << std::setprecision(3)
+              << build / reps << " ms, load " << load / reps << " ms, then walk "
+              << walk / reps << " ms (" << sum << ")\n";
+}
+
+// Send n lists of ten fixnums through a 4K-word buffer, against consing
+// them up again at the far end.
+static void bench_wire(size_t n, int reps) {
+    const size_t chunk = 4096;
+    std::vector<uintptr_t> words;
+    std::vector<uintptr_t> buf(chunk);
+    double cons = 0, enc = 0, dec = 0;
+    size_t sum = 0;
+    for (int r = 0; r < reps; r++) {
+        spaces::CopySpace s;
+        double t0 = now_ms();
+        core::handle_t top = s.make_vec(core::headers::vec, n, core::FixInt(0));
+        for (size_t i = 0; i < n; i++) {
+            core::handle_t l = s.null();
+            for (int k = 0; k < 10; k++)
+                l = s.cons(core::FixInt(k), l);
+            top.vec_store(i, l);
+        }
+        double t1 = now_ms();
+        wire::Encoder e(top);
+        words.clear();
+        while (!e.done()) {
+            size_t k = e.encode(buf.data(), chunk);
+            words.insert(words.end(), buf.begin(), buf.begin() + k);
+        }
+        double t2 = now_ms();
+        spaces::CopySpace t;
+        wire::Decoder d(t);
+        for (size_t i = 0; i < words.size(); i += chunk)
+            d.decode(&words[i], words.size() - i < chunk ? words.size() - i : chunk);
+        sum += d.result().vec_fetch(n / 2).seq_cdr().seq_car().fixint_value();
+        double t3 = now_ms();
+        cons += t1 - t0;
+        enc += t2 - t1;
+        dec += t3 - t2;
+    }
+    std::cout << "wire: " << n << " lists, " << words.size() << " words; cons "
+              << std::fixed << std::setprecision(3) << cons / reps << " ms, encode "
+              << enc / reps << " ms, decode " << dec / reps << " ms (" << sum << ")\n";
+}
+
+// The same n fixnums in vecs of 512, then in narrow vecs: the words
+// each takes, a walk that fetches every element, and a collection.
+static void bench_narrow(size_t n, int reps) {
+    const size_t per = 512;
+    size_t count = (n + per - 1) / per;
+    for (int narrow = 0; narrow < 2; narrow++) {
+        spaces::CopySpace s;
+        core::handle_t top = s.make_vec(core::headers::vec, count, core::FixInt(0));
+        for (size_t k = 0; k < count; k++) {
+            core::handle_t v = narrow ? s.make_nvec(per, core::FixInt(k))
+                                      : s.make_vec(core::headers::vec, per, core::FixInt(k));
+            top.vec_store(k, v);
+        }
+        s.collect();
+        uintptr_t *first = (uintptr_t*) (top.vec_fetch(0).uint() & ~0x7);
+        size_t words = count * core::Header::object_words(first);
+        intptr_t sum = 0;
+        double t0 = now_ms();
+        for (int r = 0; r < reps; r++)
+            for (size_t k = 0; k < count; k++) {
+                core::HandleScope scope(s);
+                core::local_t v = s.local(top.vec_fetch(k));
+                for (size_t i = 0; i < per; i++) {
+                    core::local_t x = narrow ? v.nvec_fetch(i) : v.vec_fetch(i);
+                    sum += x.fixint_value();
+                }
+            }
+        double walk = now_ms() - t0;
+        double best = 0;
+        for (int r = 0; r < 5; r++) {
+            double t1 = now_ms();
+            s.collect();
+            double t = now_ms() - t1;
+            if (r == 0 || t < best)
+                best = t;
+        }
+        std::cout << (narrow ? "  narrow: nvecs " : "narrow: vecs ") << count * per
+                  << " elements in " << words << " words, walk " << std::fixed
+                  << std::setprecision(2) << 1e6 * walk / (double(count) * per * reps)
+                  << " ns/element, collect " << std::setprecision(3) << best
+                  << " ms (" << sum << ")\n";
+    }
+}
+
+// n lists of the same 32 fixnums, kept in a vec, built with cons and
+// then with hcons: the time to build them, the words they take once
+// collected, and the time to check each against the first (a walk of
+// both lists, or one comparison of interned ones).
+static void bench_intern(size_t n, int reps) {
+    const long len = 32;
+    for (int interned = 0; interned < 2; interned++) {
+        spaces::CopySpace s;
+        core::Interns table(s);
+        core::handle_t top = s.make_vec(core::headers::vec, n, core::FixInt(0));
+        double t0 = now_ms();
+        for (size_t k = 0; k < n; k++) {
+            core::handle_t l = s.null();
+            for (long i = len; i > 0; i--)
+                l = interned ? s.hcons(core::FixInt(i), l) : s.cons(core::FixInt(i), l);
+            top.vec_store(k, l);
+        }
+        double build = now_ms() - t0;
+        s.collect();
+        size_t words = s.words_in_use();
+        size_t same = 0;
+        double t1 = now_ms();
+        for (int r = 0; r < reps; r++)
+            for (size_t k = 0; k < n; k++) {
+                core::HandleScope scope(s);
+                core::local_t a = s.local(top.vec_fetch(0));
+                core::local_t b = s.local(top.vec_fetch(k));
+                if (interned) {
+                    same += a.uint() == b.uint();
+                    continue;
+                }
+                while (!a.is_null() && !b.is_null() &&
+                       a.seq_car().uint() == b.seq_car().uint()) {
+                    a = a.seq_cdr();
+                    b = b.seq_cdr();
+                }
+                same += a.is_null() && b.is_null();
+            }
+        double check = now_ms() - t1;
+        std::cout << (interned ? "  intern: hcons " : "intern: cons ") << n << " lists, build "
+                  << std::fixed << std::setprecision(3) << build << " ms, " << words
+                  << " words, check " << std::setprecision(2)
+                  << 1e6 * check / (double(n) * reps) << " ns/list (" << same << ")\n";
+    }
+}
+
+// n requests, each consing 1000 short lists that die with it while
+// a long-lived list of 100000 cells sits in the space: first all in
+// one copying space, which collects as it fills, then with each
+// request in a region scope over it, which gives the lists back whole.
+static void bench_region(size_t n, int reps) {
+    for (int region = 0; region < 2; region++) {
+        double best = 0;
+        size_t gcs = 0;
+        long sum = 0;
+        for (int r = 0; r < reps; r++) {
+            spaces::CopySpace s;
+            spaces::RegionSpace g(s);
+            core::handle_t keep = s.make_list(100000, core::FixInt(1));
+            double t0 = now_ms();
+            for (size_t k = 0; k < n; k++) {
+                spaces::RegionScope scope(g);
+                core::Space &a = region ? (core::Space&) g : (core::Space&) s;
+                for (int j = 0; j < 1000; j++) {
+                    core::HandleScope hs(a);
+                    core::local_t l = a.local(core::constants::Literal_null);
+                    for (int i = 0; i < 10; i++)
+                        l = a.cons(core::FixInt(i), l);
+                    sum += l.seq_car().fixint_value();
+                }
+            }
+            double t = now_ms() - t0;
+            if (r == 0 || t < best)
+                best = t;
+            gcs = s.collections();
+        }
+        std::cout << (region ? "  region: scopes " : "region: copying ") << n
+                  << " requests, " << std::fixed << std::setprecision(2)
+                  << 1e3 * best / n << " us/request, " << gcs << " gcs (" << sum << ")\n";
+    }
+}
+
+// Cons throughput of 1..max_threads threads, each consing lists of 100
+// through a mutator of its own in one shared space (most of it garbage,
+// so collections stop them all now and then); per thread, cells per
+// microsecond, and the total against one thread's.
+static void bench_threads(size_t cells, size_t max_threads) {
+    std::cout << "threads: " << cells << " conses a thread\n";
+    double base = 0;
+    for (size_t t = 1; t <= max_threads; t++) {
+        spaces::SharedSpace s;
+        std::vector<std::thread> ts;
+        std::vector<long> sums(t);
+        double t0 = now_ms();
+        for (size_t i = 0; i < t; i++)
+            ts.push_back(std::thread([&s, &sums, cells, i] {
+                spaces::Mutator m(s);
+                core::handle_t l = m.null();
+                for (size_t j = 0; j < cells; j++) {
+                    if (j % 100 == 0)
+                        l = m.null();
+                    l = m.cons(core::FixInt(j), l);
+                }
+                sums[i] = l.seq_car().fixint_value();
+            }));
+        for (size_t i = 0; i < t; i++)
+            ts[i].join();
+        double ms = now_ms() - t0;
+        double rate = t * cells / ms / 1000;
+        if (t == 1)
+            base = rate;
+        std::cout << std::setw(4) << t << " threads: "
+                  << std::fixed << std::setprecision(2) << std::setw(9) << ms
+                  << " ms " << std::setw(7) << rate / t << " /us each  x" << rate / base
+                  << "  (" << s.collections() << " gcs, " << sums[0] << ")\n";
+    }
+}
+
+// As bench_threads, but each thread keeps a long-lived list of its own
+// and conses its garbage either through its mutator, so that every
+// collection stops them all and copies every list, or in a shard of
+// its own, which it collects alone.
+static void bench_shards(size_t cells, size_t threads) {
+    std::cout << "shards: " << cells << " conses a thread, " << threads << " threads\n";
+    for (int sharded = 0; sharded < 2; sharded++) {
+        spaces::SharedSpace s;
+        std::vector<std::thread> ts;
+        std::vector<size_t> gcs(threads);
+        double t0 = now_ms();
+        for (size_t i = 0; i < threads; i++)
+            ts.push_back(std::thread([&s, &gcs, cells, sharded, i] {
+                spaces::Mutator m(s);
+                spaces::Shard sh(m);
+                core::Space &a = sharded ? (core::Space&) sh : (core::Space&) m;
+                core::handle_t keep = a.make_list(100000, core::FixInt(1));
+                core::handle_t l = a.null();
+                for (size_t j = 0; j < cells; j++) {
+                    if (j % 100 == 0)
+                        l = a.null();
+                    l = a.cons(core::FixInt(j), l);
+                }
+                gcs[i] = sh.collections();
+            }));
+        for (size_t i = 0; i < threads; i++)
+            ts[i].join();
+        double ms = now_ms() - t0;
+        size_t local = 0;
+        for (size_t i = 0; i < threads; i++)
+            local += gcs[i];
+        std::cout << (sharded ? "  sharded: " : "   shared: ")
+                  << std::fixed << std::setprecision(2) << std::setw(9) << ms << " ms  ("
+                  << s.collections() << " stop-the-world gcs, " << local << " shard gcs)\n";
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *which = argc > 1 ? argv[1] : "all";
+    bool all = strcmp(which, "all") == 0;
+    size_t hw = std::thread::hardware_concurrency();
+
+    if (all || strcmp(which, "mark") == 0)
+        bench_mark(argc > 2 ? atol(argv[2]) : 2000000,
+                   argc > 3 ? atol(argv[3]) : (hw ? hw : 4));
+    if (all || strcmp(which, "pause") == 0)
+        bench_pause(argc > 2 ? atol(argv[2]) : 1000000,
+                    argc > 3 ? atof(argv[3]) : 1.0);
+    if (all || strcmp(which, "walk") == 0)
+        bench_walk(argc > 2 ? atol(argv[2]) : 1000000,
+                   argc > 3 ? atoi(argv[3]) : 10);
+    if (all || strcmp(which, "roots") == 0)
+        bench_roots(argc > 2 ? atol(argv[2]) : 1000000,
+                    argc > 3 ? atoi(argv[3]) : 10);
+    if (all || strcmp(which, "runs") == 0)
+        bench_runs(argc > 2 ? atol(argv[2]) : 1000000,
+                   argc > 3 ? atoi(argv[3]) : 10);
+    if (all || strcmp(which, "order") == 0)
+        bench_order(argc > 2 ? atol(argv[2]) : 10000000,
+                    argc > 3 ? atol(argv[3]) : 100);
+    if (all || strcmp(which, "dispatch") == 0)
+        bench_dispatch(argc > 2 ? atol(argv[2]) : 1000000,
+                       argc > 3 ? atoi(argv[3]) : 20);
+    if (all || strcmp(which, "classify") == 0)
+        bench_classify(argc > 2 ? atol(argv[2]) : 1000000,
+                       argc > 3 ? atoi(argv[3]) : 20);
+    if (all || strcmp(which, "interior") == 0)
+        bench_interior(argc > 2 ? atol(argv[2]) : 100000,
+                       argc > 3 ? atol(argv[3]) : 20);
+    if (all || strcmp(which, "records") == 0)
+        bench_records(argc > 2 ? atol(argv[2]) : 1000,
+                      argc > 3 ? atoi(argv[3]) : 1000);
+    if (all || strcmp(which, "large") == 0)
+        bench_large(argc > 2 ? atol(argv[2]) : 32 * 1024,
+                    argc > 3 ? atol(argv[3]) : 64);
+    if (all || strcmp(which, "raw") == 0)
+        bench_raw(argc > 2 ? atol(argv[2]) : 64 * 1024,
+                  argc > 3 ? atoi(argv[3]) : 1000);
+    if (all || strcmp(which, "pin") == 0)
+        bench_pin(argc > 2 ? atol(argv[2]) : 64 * 1024,
+                  argc > 3 ? atoi(argv[3]) : 1000);
+    if (all || strcmp(which, "image") == 0)
+        bench_image(argc > 2 ? atol(argv[2]) : 200000,
+                    argc > 3 ? atoi(argv[3]) : 5);
+    if (all || strcmp(which, "threads") == 0)
+        bench_threads(argc > 2 ? atol(argv[2]) : 20000000,
+                      argc > 3 ? atol(argv[3]) : (hw ? hw : 4));
+    if (all || strcmp(which, "shards") == 0)
+        bench_shards(argc > 2 ? atol(argv[2]) : 20000000,
+                     argc > 3 ? atol(argv[3]) : (hw ? hw : 4));
+    if (all || strcmp(which, "narrow") == 0)
+        bench_narrow(argc > 2 ? atol(argv[2]) : 4000000,
+                     argc > 3 ? atoi(argv[3]) : 5);
+    if (all || strcmp(which, "wire") == 0)
+        bench_wire(argc > 2 ? atol(argv[2]) : 100000,
+                   argc > 3 ? atoi(argv[3]) : 5);
+    if (all || strcmp(which, "intern") == 0)
+        bench_intern(argc > 2 ? atol(argv[2]) : 100000,
+                     argc > 3 ? atoi(argv[3]) : 5);
+    if (all || strcmp(which, "region") == 0)
+        bench_region(argc > 2 ? atol(argv[2]) : 2000,
+                     argc > 3 ? atoi(argv[3]) : 5);
+    return 0;
+}
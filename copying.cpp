@@ -0,0 +1,310 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "spaces.h"
+#include "copying.h"
+#include "wordscan.h"
+
+namespace spaces {
+    using core::Word;
+    using core::Header;
+
+    CopySpace::CopySpace()
+        : BlockSpace(), budget(policy.heap_blocks()),
+          gc_count(0), order(cdr_first), collecting(false),
+          resumed(0), resumed_at(0) {}
+
+    CopySpace::CopySpace(Policy const &p)
+        : BlockSpace(p), budget(p.heap_blocks()),
+          gc_count(0), order(cdr_first), collecting(false),
+          resumed(0), resumed_at(0) {}
+
+    void* CopySpace::refill(core::formatted_t h, size_t n) {
+        if (!this->collecting &&
+            this->block_count + this->large_blocks() >= this->budget) {
+            this->collect();
+            if (size_t(this->limit - this->cursor) >= n)
+                return this->bump(h, n);
+        }
+        return BlockSpace::refill(h, n);
+    }
+
+    // If the object at p has already been copied, its copy.
+    uintptr_t* CopySpace::forwarded(uintptr_t *p) {
+        uintptr_t w = p[0];
+        if (Word::variant_of(w) != Word::valref)
+            return 0;
+        uintptr_t *q = (uintptr_t*) (w & ~0x7);
+        if (!Heap::contains(q))
+            return 0;
+        Block *b = Block::of(q);
+        if (b->flags & Block::to_space)
+            return q;
+        if (b == this->resumed && q >= (uintptr_t*) this->resumed_at)
+            return q;
+        return 0;
+    }
+
+    // A copy keeps the raw bytes of a bvl or blob aligned.
+    uintptr_t* CopySpace::copy(uintptr_t *p, size_t n) {
+        core::formatted_t h = *(core::formatted_t*) p;
+        uintptr_t *q;
+        switch (Word::variant_of(p[0])) {
+        case Word::bvlhdr: case Word::blobhdr:
+            q = (uintptr_t*) this->gcalloc_raw(h, n, Header::first_raw(p));
+            break;
+        default:
+            q = (uintptr_t*) this->gcalloc(h, n);
+        }
+        memcpy(q + 1, p + 1, (n - 1) * sizeof(uintptr_t));
+        p[0] = uintptr_t(q) | 0x5;
+        return q;
+    }
+
+    // The object of this space that holds p (see object_start).  A
+    // forwarded object is as long as its copy.
+    uintptr_t* CopySpace::object_of(uintptr_t *p) {
+        return object_start(p, [this](uintptr_t *s) {
+            uintptr_t *q = this->forwarded(s);
+            uintptr_t *o = q ? q : s;
+            return Header::is_header(o[0]) ? Header::object_words(o) : size_t(2);
+        });
+    }
+
+    // Only the starts of objects are held weakly.
+    uintptr_t CopySpace::Survivors::survivor(uintptr_t w) {
+        uintptr_t *p = (uintptr_t*) (w & ~0x7);
+        if (!Heap::contains(p))
+            return w;
+        Block *b = Block::of(p);
+        if (!(b->flags & Block::condemned))
+            return w;
+        if (b->flags & Block::large)
+            return 0;
+        uintptr_t *q = this->space->forwarded(p);
+        return q ? uintptr_t(q) | (w & 0x7) : 0;
+    }
+
+    uintptr_t CopySpace::evacuate(uintptr_t w) {
+        Word::variant_t v = Word::variant_of(w);
+        switch (v) {
+        case Word::snokref: case Word::konsref:
+        case Word::valref:  case Word::intrref:
+            break;
+        default:
+            return w;
+        }
+        uintptr_t *p = (uintptr_t*) (w & ~0x7);
+        if (!Heap::contains(p))
+            return w;
+        Block *b = Block::of(p);
+        if (!(b->flags & Block::condemned))
+            return w;
+        if (b->flags & Block::large) { // kept where it is
+            this->large.keep(b);
+            return w;
+        }
+
+        uintptr_t tag = w & 0x7;
+        uintptr_t *o = p; // start of the object containing p
+        switch (v) {
+        case Word::konsref: {
+            uintptr_t *q = this->forwarded(p);
+            if (q == 0) {
+                q = this->copy(p, 2);
+                if (this->order == cdr_first)
+                    this->copy_cdrs(q);
+            }
+            return uintptr_t(q) | tag;
+        }
+        case Word::valref:
+            if (Word::variant_of(p[0]) == Word::blobmdr)
+                o = p - Header::midder_delta(p[0]);
+            break;
+        case Word::snokref: // a cell of a run, inside the run's vec
+        case Word::intrref:
+            o = this->object_of(p);
+            break;
+        default:
+            assert(0);
+        }
+        uintptr_t *q = this->forwarded(o);
+        if (q == 0)
+            q = this->copy(o, Header::object_words(o));
+        return uintptr_t(q + (p - o)) | tag;
+    }
+
+    namespace {
+        class Pinner : public core::AmbiguousVisitor {
+        public:
+            Pinner(core::Space *s, LargeObjects *l) : space(s), large(l) {}
+            virtual void visit(uintptr_t w) {
+                uintptr_t *p = (uintptr_t*) (w & ~0x7);
+                if (!Heap::contains(p))
+                    return;
+                Block *b = Block::of(p);
+                if (b == 0 || b->owner != this->space || !(b->flags & Block::condemned))
+                    return;
+                if (p < (uintptr_t*) b->start() || p >= (uintptr_t*) b->cursor)
+                    return;
+                if (b->flags & Block::large)
+                    this->large->keep(b);
+                else
+                    b->flags = (b->flags & ~Block::condemned) | Block::pinned;
+            }
+        private:
+            core::Space *space;
+            LargeObjects *large;
+        };
+    }
+
+    void CopySpace::visit_pinning(core::AmbiguousVisitor &v) {
+        this->visit_stack(v);
+        this->visit_pins(v);
+    }
+
+    Block* CopySpace::pin(Block **from) {
+        Pinner pn(this, &this->large);
+        this->visit_pinning(pn);
+        Block *pinned = 0, **tail = &pinned;
+        for (Block **l = from; *l; ) {
+            Block *b = *l;
+            if (!(b->flags & Block::pinned)) {
+                l = &b->link;
+                continue;
+            }
+            *l = b->link;
+            b->link = 0;
+            *tail = b;
+            tail = &b->link;
+        }
+        return pinned;
+    }
+
+    // Pinned blocks join the space as they are.
+    void CopySpace::adopt(Block *pinned) {
+        while (pinned) {
+            Block *b = pinned;
+            pinned = b->link;
+            b->link = 0;
+            if (this->last)
+                this->last->link = b;
+            else
+                this->blocks = b;
+            this->last = b;
+            this->block_count++;
+            b->scan = b->start();
+        }
+    }
+
+    // Copy the rest of the kons chain behind the copied cell q, cell by
+    // cell, until it ends or reaches a cell already copied (or not
+    // being evacuated).
+    void CopySpace::copy_cdrs(uintptr_t *q) {
+        for (;;) {
+            uintptr_t w = q[1];
+            if (Word::variant_of(w) != Word::konsref)
+                return;
+            uintptr_t *p = (uintptr_t*) (w & ~0x7);
+            if (!Heap::contains(p) || !(Block::of(p)->flags & Block::condemned))
+                return;
+            uintptr_t *r = this->forwarded(p);
+            if (r) {
+                q[1] = uintptr_t(r) | 0x1;
+                return;
+            }
+            r = this->copy(p, 2);
+            q[1] = uintptr_t(r) | 0x1;
+            q = r;
+        }
+    }
+
+    size_t CopySpace::scan_object(uintptr_t *p) {
+        if (!Header::is_header(p[0])) {
+            // A header-less pair: car, then cdr.
+            p[0] = this->evacuate(p[0]);
+            p[1] = this->evacuate(p[1]);
+            return 2;
+        }
+        if (Header::is_record(p[0])) {
+            core::Layout const *l = core::Layout::of(p);
+            core::each_record_ref(core::Layout::slots(p), l, 0, l->length(),
+                                  [this](uintptr_t *slot, bool untagged) {
+                if (untagged) // the address of a header: evacuate as a valref
+                    *slot = this->evacuate(*slot | 0x5) & ~uintptr_t(0x7);
+                else
+                    *slot = this->evacuate(*slot);
+            });
+            return Header::object_words(p);
+        }
+        size_t i = Header::first_value(p);
+        core::each_ref(p + i, Header::value_words(p),
+                       [this](uintptr_t *slot) { *slot = this->evacuate(*slot); });
+        return Header::object_words(p);
+    }
+
+    void CopySpace::scan_blocks(Block *first) {
+        // Only the current block can grow behind the scan; full blocks
+        // are done once scanned up to their cursor.  Large objects are
+        // scanned as they are kept.
+        bool progress = true;
+        while (progress) {
+            progress = false;
+            if (first == 0)
+                first = this->blocks;
+            for (Block *b = first; b; b = b->link) {
+                while (b->scan < this->fill(b)) {
+                    b->scan += this->scan_object((uintptr_t*) b->scan);
+                    progress = true;
+                }
+            }
+            for (uintptr_t *p; (p = this->large.next_to_scan()); progress = true)
+                this->scan_object(p[0] == Header::filler() ? p + 1 : p); // see gcalloc_raw
+            while (first && first != this->current && first->scan == first->cursor)
+                first = first->link;
+        }
+    }
+
+    void CopySpace::collect() {
+        this->retire();
+        Block *from = this->blocks;
+        for (Block *b = from; b; b = b->link)
+            b->flags |= Block::condemned;
+        this->blocks = this->last = 0;
+        this->block_count = 0;
+        this->large.condemn();
+        this->adopt(this->pin(&from));
+
+        this->collecting = true;
+        this->fresh_flags = Block::to_space;
+        Evacuator ev(this);
+        this->visit_roots(ev);
+        this->scan_blocks(this->blocks);
+        Survivors sv(this);
+        this->sweep_weak(sv);
+        this->fresh_flags = 0;
+        this->collecting = false;
+        for (Block *b = this->blocks; b; b = b->link)
+            b->flags &= ~(Block::to_space | Block::pinned);
+        this->large.sweep();
+
+        while (from) {
+            Block *b = from;
+            from = b->link;
+            Heap::give(b, b->units);
+        }
+        this->gc_count++;
+
+        // Keep at least as much headroom as there are survivors.
+        size_t live = this->block_count + this->large_blocks();
+        if (2 * live > this->budget)
+            this->budget = 2 * live;
+    }
+}
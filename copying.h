@@ -0,0 +1,115 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef COPYING_H_INCLUDED
+#error "copying.h multiply included"
+#endif
+#define COPYING_H_INCLUDED
+
+#ifndef SPACES_H_INCLUDED
+#error "copying.h requires previous include: spaces.h"
+#endif
+
+namespace spaces {
+
+    // A copying space collects by evacuating everything reachable from
+    // its handles into fresh blocks (Cheney-style: the copies themselves
+    // are the queue of objects still to be scanned), then giving the
+    // old blocks back to the heap.  Survivors end up compacted, in the
+    // order the scan reached them.  Large objects are not copied but
+    // kept in place (see LargeObjects).
+    //
+    // A copied object leaves a forwarding word in its first word: a
+    // valref to the copy.  A from-space object never refers to where
+    // the running collection puts its copies (blocks made during the
+    // collection, or the tail of the resumed block, if any) so that
+    // word cannot be mistaken for a field.
+    //
+    // Copying a kons cell normally goes on to copy the rest of its cdr
+    // chain right behind it (cdr_first), so that a list comes out of
+    // its first collection in consecutive cells, its cars following
+    // in the same order once the scan reaches them.  Plain Cheney
+    // order (breadth_first) interleaves the cells of lists reached
+    // together.
+    //
+    // In the conservative root mode the space is mostly-copying: a
+    // block that any stack word points into is pinned, not evacuated,
+    // and every object in it is kept and scanned as if live.  A block
+    // holding an object under a core::Pin is kept the same way, in any
+    // mode.
+    class CopySpace : public BlockSpace {
+    public:
+        CopySpace();
+        explicit CopySpace(Policy const &p);
+
+        virtual void collect();
+
+        size_t collections() const { return this->gc_count; }
+        size_t blocks_in_use() const { return this->block_count; }
+
+        enum Order { breadth_first, cdr_first };
+        void set_copy_order(Order o) { this->order = o; }
+
+    protected:
+        virtual void* refill(core::formatted_t h, size_t n);
+
+        // w, with a reference into a condemned block replaced by the
+        // corresponding reference into the copy of its target.
+        uintptr_t evacuate(uintptr_t w);
+        // Evacuate the fields of the object at p; returns its length.
+        size_t scan_object(uintptr_t *p);
+        // Scan copied objects, in the blocks from first on (from the
+        // first of the space's if 0), until no unscanned copies remain.
+        void scan_blocks(Block *first);
+
+        core::formatted_t* fill(Block *b) {
+            return b == this->current ? this->cursor : b->cursor;
+        }
+
+        // Pin every condemned block (in the chain at *from) that a stack
+        // word or a core::Pin points into; returns them, unlinked from
+        // that chain.
+        Block* pin(Block **from);
+        // The words that pin: the stack's, in the conservative root
+        // mode, and those held by core::Pins.
+        virtual void visit_pinning(core::AmbiguousVisitor &v);
+        // Append pinned blocks to the space's list, to be scanned whole.
+        void adopt(Block *pinned);
+
+        // The object of this space that holds p.
+        uintptr_t* object_of(uintptr_t *p);
+
+    private:
+        uintptr_t* copy(uintptr_t *p, size_t n);
+        uintptr_t* forwarded(uintptr_t *p);
+        void copy_cdrs(uintptr_t *q);
+
+    protected:
+        class Evacuator : public core::RootVisitor {
+        public:
+            Evacuator(CopySpace *s) : space(s) {}
+            virtual void visit(uintptr_t *slot) {
+                *slot = space->evacuate(*slot);
+            }
+        private:
+            CopySpace *space;
+        };
+        // What a collection left of the space's weakly held objects;
+        // for after the scan, while the condemned blocks are there.
+        class Survivors : public core::WeakVisitor {
+        public:
+            Survivors(CopySpace *s) : space(s) {}
+            virtual uintptr_t survivor(uintptr_t w);
+        private:
+            CopySpace *space;
+        };
+
+        size_t budget;    // collect once this many blocks are in use
+        size_t gc_count;
+        Order order;
+        bool collecting;
+        // A block that existed before the running collection but that
+        // receives its copies from resumed_at onwards.
+        Block *resumed;
+        core::formatted_t *resumed_at;
+    };
+};
@@ -1,11 +1,16 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <cassert>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #include "ctors.h"
 #include "status.h"
 #include "recv.h"
+#include "trace.h"
 #include "core.h"
+#include "intern.h"
 
 #include <iostream>
 #include <iomanip>
@@ -24,135 +29,620 @@ std::ostream& operator << (std::ostream& os, const core::Handle& h) {
               << "}";
 }
 
-template <typename U>
-static void dbmsgln(const char *name, const char *msg, U val, const char *post) {
-    std::cout << std::setw(8) << std::setfill(' ') << name << msg  << val << post << "\n";
-}
+namespace core {
+    constexpr uint8_t Word::variant_table[32];
 
-template <typename U>
-static void dbmsgln(const char *name, const char *msg, U val) {
-    std::cout << std::setw(8) << std::setfill(' ') << name << msg  << val << "\n";
-}
+    Tagged Tagged::seq_car() {
+        assert(this->is_kons() || this->is_snok());
+        tagged_t *m = (tagged_t*)(this->val & ~0x7);
+        trace::record(trace::car, m);
+        return m[0];
+    }
 
-template <typename U, typename V>
-static void dbmsgln(const char *name, const char *msg, U val, const char *msg2, V val2) {
-    std::cout << std::setw(8) << std::setfill(' ') << name << msg  << val << "\n";
-}
+    Tagged Tagged::seq_cdr() {
+        assert(this->is_kons() || this->is_snok());
+        tagged_t *m = (tagged_t*)(this->val & ~0x7);
+        trace::record(trace::cdr, m);
+        if (this->variant() == snokref) {
+            // In a run the next cell follows, up to the end marker.
+            if (!Header::is_run_end(m[1].uint())) {
+                Tagged next(*this);
+                next.val += sizeof(tagged_t);
+                return next;
+            }
+            return m[2];
+        }
+        return m[1];
+    }
 
-static void dbmsglnold(const char *pre, uintptr_t val, const char *post) {
-    std::cout << pre << std::hex << val << "[0]" << "\n";
-}
+    // Every store into a heap slot comes through here.  While a space
+    // marks incrementally the old value is logged first (see Satb);
+    // references (the odd tags) dirty the slot's card (see Cards).
+    static void store(tagged_t *slot, tagged_t x) {
+        if (Satb::active)
+            Satb::log(slot->uint());
+        *slot = x;
+        if (x.uint() & 0x1)
+            Cards::mark(slot);
+    }
 
-namespace core {
-    Tagged::Tagged(word_t w) : Formatted(w) {
-        dbmsgln("Tagged", " construction of ", w);
+    // The car slot of a pair; the cdr slot follows it.
+    static tagged_t* pair_slots(uintptr_t val) {
+        tagged_t *m = (tagged_t*)(val & ~0x7);
+        return (Word::variant_of(val) == Word::valref) ? m + 1 : m;
     }
-    Tagged::Tagged(Tagged const &x) : Formatted(x) {
-        dbmsgln("Tagged", " construction of ", word_t(x));
+
+    Tagged Tagged::pair_car() {
+        assert(this->is_pair());
+        return pair_slots(this->val)[0];
     }
 
+    Tagged Tagged::pair_cdr() {
+        assert(this->is_pair());
+        if (this->is_snok())
+            return this->seq_cdr();
+        return pair_slots(this->val)[1];
+    }
 
-    bool Tagged::is_fixint() {
-        return (this->variant() == fixnum);
+    void Tagged::pair_setcar(Tagged x) {
+        assert(this->is_pair());
+        store(&pair_slots(this->val)[0], x);
     }
 
-    bool Tagged::is_bool() {
-        return (this->val == constants::Literal_true.val ||
-                this->val == constants::Literal_false.val);
+    void Tagged::pair_setcdr(Tagged x) {
+        assert(this->is_pair());
+        tagged_t *m = pair_slots(this->val);
+        if (this->is_snok()) {
+            // Only the last cell of a run has a cdr slot to store into.
+            assert(Header::is_run_end(m[1].uint())); // GUMP: runs keep their spine
+            m++;
+        }
+        store(&m[1], x);
     }
 
-    bool Tagged::is_null() {
-        return (this->val == constants::Literal_null.val);
+    size_t Tagged::vec_value_capacity() {
+        assert(this->is_vec());
+        return Header::value_words((uintptr_t*)(this->val & ~0x7));
     }
 
-    bool Tagged::is_void() {
-        return (this->val == constants::Literal_void.val);
+    Tagged Tagged::vec_fetch(uintptr_t i) {
+        assert(this->is_vec());
+        uintptr_t *m = (uintptr_t*)(this->val & ~0x7);
+        assert(i < Header::value_words(m));
+        return *(tagged_t*)(m + Header::first_value(m) + i);
     }
 
-    bool Tagged::truth() {
-        return (this->val != constants::Literal_false.val);
+    void Tagged::vec_store(uintptr_t i, Tagged x) {
+        assert(this->is_vec());
+        uintptr_t *m = (uintptr_t*)(this->val & ~0x7);
+        assert(i < Header::value_words(m));
+        store((tagged_t*)(m + Header::first_value(m) + i), x);
     }
 
-    bool Tagged::is_kons() { return (this->variant() == konsref); }
-    bool Tagged::is_snok() { return (this->variant() == snokref); }
+    // The bytes of a bvl follow its header and length word.
+    static uint8_t* bvl_bytes(uintptr_t *m) {
+        return (uint8_t*)(m + Header::first_value(m));
+    }
 
-    bool Tagged::is_seq() {
-        return (this->is_null() || this->is_kons() || this->is_snok());
+    size_t Tagged::bvl_byte_capacity() {
+        assert(this->is_bvl());
+        return Header::raw_bytes((uintptr_t*)(this->val & ~0x7));
     }
 
-    Tagged Tagged::seq_car() {
-        assert(this->is_kons() || this->is_snok());
-        tagged_t *m = (tagged_t*)(this->val & ~0x7);
-        dbmsgln("car dereferencing ", "", uintptr_t(m), "[0]\n");
-        return m[0];
+    uint8_t Tagged::bvl_get(uintptr_t i) {
+        assert(this->is_bvl());
+        uintptr_t *m = (uintptr_t*)(this->val & ~0x7);
+        assert(i < Header::raw_bytes(m));
+        return bvl_bytes(m)[i];
     }
 
-    Tagged Tagged::seq_cdr() {
-        assert(this->is_kons() || this->is_snok());
-        tagged_t *m = (tagged_t*)(this->val & ~0x7);
-        return m[1];
+    void Tagged::bvl_set(uintptr_t i, uint8_t x) {
+        assert(this->is_bvl());
+        uintptr_t *m = (uintptr_t*)(this->val & ~0x7);
+        assert(i < Header::raw_bytes(m));
+        bvl_bytes(m)[i] = x;
     }
 
-    Ref::Ref(intptr_t w, variant_t variant) : Tagged(tagvariant(w, variant)) {
-        dbmsgln("Ref ", " construction of w:", w);
+    Bytes Tagged::bvl_raw() {
+        assert(this->is_bvl());
+        uintptr_t *m = (uintptr_t*)(this->val & ~0x7);
+        return Bytes(bvl_bytes(m), Header::raw_bytes(m));
     }
 
+    // The header of the blob that val refers to, at its header or at
+    // its midder; its bytes follow the midder.
+    static uintptr_t* blob_header(uintptr_t val) {
+        uintptr_t *m = (uintptr_t*)(val & ~0x7);
+        if (Word::variant_of(m[0]) == Word::blobmdr)
+            m -= Header::midder_delta(m[0]);
+        return m;
+    }
+    static uint8_t* blob_bytes(uintptr_t *m) {
+        return (uint8_t*)(m + Header::first_value(m) + Header::value_words(m) + 1);
+    }
 
-#define HANDLE_WRAPPED_METHOD_0(type_t, m) \
-    type_t Handle::m() { return value.m(); }
+    size_t Tagged::blob_val_capacity() {
+        assert(this->is_blob());
+        return Header::value_words(blob_header(this->val));
+    }
+
+    size_t Tagged::blob_raw_capacity() {
+        assert(this->is_blob());
+        return Header::raw_bytes(blob_header(this->val));
+    }
+
+    Tagged Tagged::blob_fetch(uintptr_t i) {
+        assert(this->is_blob());
+        uintptr_t *m = blob_header(this->val);
+        assert(i < Header::value_words(m));
+        return *(tagged_t*)(m + Header::first_value(m) + i);
+    }
+
+    void Tagged::blob_store(uintptr_t i, Tagged x) {
+        assert(this->is_blob());
+        uintptr_t *m = blob_header(this->val);
+        assert(i < Header::value_words(m));
+        store((tagged_t*)(m + Header::first_value(m) + i), x);
+    }
+
+    uint8_t Tagged::blob_get(uintptr_t i) {
+        assert(this->is_blob());
+        uintptr_t *m = blob_header(this->val);
+        assert(i < Header::raw_bytes(m));
+        return blob_bytes(m)[i];
+    }
+
+    void Tagged::blob_set(uintptr_t i, uint8_t x) {
+        assert(this->is_blob());
+        uintptr_t *m = blob_header(this->val);
+        assert(i < Header::raw_bytes(m));
+        blob_bytes(m)[i] = x;
+    }
+
+    Bytes Tagged::blob_raw() {
+        assert(this->is_blob());
+        uintptr_t *m = blob_header(this->val);
+        return Bytes(blob_bytes(m), Header::raw_bytes(m));
+    }
+
+    // Untagged pointer slots (closep, farptr) hold the address of a
+    // header, and are barriered as the valref they stand for.
+    static void store_pointer(uintptr_t *slot, uintptr_t p) {
+        if (Satb::active && *slot)
+            Satb::log(*slot | 0x5);
+        *slot = p;
+        if (p)
+            Cards::mark(slot);
+    }
 
-    HANDLE_WRAPPED_METHOD_0(bool, is_seq);
-    HANDLE_WRAPPED_METHOD_0(bool, is_fixint);
-    HANDLE_WRAPPED_METHOD_0(bool, is_null);
-#undef HANDLE_WRAPPED_METHOD_0
+    Layout* Layout::make(size_t len) {
+        size_t words = len ? (len + 31) / 32 : 1;
+        Layout *l = (Layout*) calloc(1, sizeof(Layout) + (words - 1) * sizeof(uint64_t));
+        assert(l != 0); // GUMP: assume mallocs don't fail
+        l->len = len;
+        return l;
+    }
+
+    size_t Tagged::record_slots() {
+        assert(this->is_record());
+        return Layout::of((uintptr_t*)(this->val & ~0x7))->length();
+    }
+
+    Tagged Tagged::record_fetch(uintptr_t i) {
+        assert(this->is_record());
+        uintptr_t *m = (uintptr_t*)(this->val & ~0x7);
+        uintptr_t w = Layout::slots(m)[i];
+        switch (Layout::of(m)->describe(i)) {
+        case Layout::tagged:
+            return *(tagged_t*) &Layout::slots(m)[i];
+        case Layout::closep: case Layout::farptr: {
+            assert(w != 0);
+            Tagged r(*this);
+            r.val = w | 0x5;
+            return r;
+        }
+        default:
+            break;
+        }
+        assert(0); // GUMP: i is a slot that holds a value
+        abort();
+    }
+
+    void Tagged::record_store(uintptr_t i, Tagged x) {
+        assert(this->is_record());
+        uintptr_t *m = (uintptr_t*)(this->val & ~0x7);
+        uintptr_t *slot = Layout::slots(m) + i;
+        switch (Layout::of(m)->describe(i)) {
+        case Layout::tagged:
+            store((tagged_t*) slot, x);
+            return;
+        case Layout::closep: case Layout::farptr:
+            assert((x.val & 0x7) == 0x5);
+            store_pointer(slot, x.val & ~0x7);
+            return;
+        default:
+            break;
+        }
+        assert(0); // GUMP: i is a slot that holds a value
+        abort();
+    }
+
+    uintptr_t Tagged::record_get(uintptr_t i) {
+        assert(this->is_record());
+        uintptr_t *m = (uintptr_t*)(this->val & ~0x7);
+        assert(Layout::of(m)->describe(i) & Layout::nonptr);
+        return Layout::slots(m)[i];
+    }
+
+    void Tagged::record_set(uintptr_t i, uintptr_t x) {
+        assert(this->is_record());
+        uintptr_t *m = (uintptr_t*)(this->val & ~0x7);
+        assert(Layout::of(m)->describe(i) & Layout::nonptr);
+        Layout::slots(m)[i] = x;
+    }
+
+    size_t Tagged::nvec_length() {
+        assert(this->is_nvec());
+        return Narrow::length((uintptr_t*)(this->val & ~0x7));
+    }
+
+    Tagged Tagged::nvec_fetch(uintptr_t i) {
+        assert(this->is_nvec());
+        uintptr_t *m = (uintptr_t*)(this->val & ~0x7);
+        assert(i < Narrow::length(m));
+        Tagged r(*this);
+        r.val = Narrow::decode(Narrow::elements(m)[i]);
+        return r;
+    }
+
+    // No barrier: an element is never a reference.
+    void Tagged::nvec_store(uintptr_t i, Tagged x) {
+        assert(this->is_nvec());
+        uintptr_t *m = (uintptr_t*)(this->val & ~0x7);
+        assert(i < Narrow::length(m));
+        Narrow::elements(m)[i] = Narrow::encode(x.val);
+    }
 
     handle_t Handle::seq_car() { return Handle(*this, value.seq_car()); }
     handle_t Handle::seq_cdr() { return Handle(*this, value.seq_cdr()); }
+    handle_t Handle::pair_car() { return Handle(*this, value.pair_car()); }
+    handle_t Handle::pair_cdr() { return Handle(*this, value.pair_cdr()); }
+    void Handle::pair_setcar(Handle x) { value.pair_setcar(x.value); }
+    void Handle::pair_setcdr(Handle x) { value.pair_setcdr(x.value); }
+    size_t Handle::vec_value_capacity() { return value.vec_value_capacity(); }
+    handle_t Handle::vec_fetch(uintptr_t i) { return Handle(*this, value.vec_fetch(i)); }
+    void Handle::vec_store(uintptr_t i, Handle x) { value.vec_store(i, x.value); }
+    size_t Handle::bvl_byte_capacity() { return value.bvl_byte_capacity(); }
+    uint8_t Handle::bvl_get(uintptr_t i) { return value.bvl_get(i); }
+    void Handle::bvl_set(uintptr_t i, uint8_t x) { value.bvl_set(i, x); }
+    Bytes Handle::bvl_raw() { return value.bvl_raw(); }
+    size_t Handle::blob_val_capacity() { return value.blob_val_capacity(); }
+    size_t Handle::blob_raw_capacity() { return value.blob_raw_capacity(); }
+    handle_t Handle::blob_fetch(uintptr_t i) { return Handle(*this, value.blob_fetch(i)); }
+    void Handle::blob_store(uintptr_t i, Handle x) { value.blob_store(i, x.value); }
+    uint8_t Handle::blob_get(uintptr_t i) { return value.blob_get(i); }
+    void Handle::blob_set(uintptr_t i, uint8_t x) { value.blob_set(i, x); }
+    Bytes Handle::blob_raw() { return value.blob_raw(); }
+    size_t Handle::record_slots() { return value.record_slots(); }
+    handle_t Handle::record_fetch(uintptr_t i) { return Handle(*this, value.record_fetch(i)); }
+    void Handle::record_store(uintptr_t i, Handle x) { value.record_store(i, x.value); }
+    uintptr_t Handle::record_get(uintptr_t i) { return value.record_get(i); }
+    void Handle::record_set(uintptr_t i, uintptr_t x) { value.record_set(i, x); }
+    size_t Handle::nvec_length() { return value.nvec_length(); }
+    handle_t Handle::nvec_fetch(uintptr_t i) { return Handle(*this, value.nvec_fetch(i)); }
+    void Handle::nvec_store(uintptr_t i, Handle x) { value.nvec_store(i, x.value); }
+
+    local_t Local::seq_car() { return Local(stack, value().seq_car()); }
+    local_t Local::seq_cdr() { return Local(stack, value().seq_cdr()); }
+    local_t Local::pair_car() { return Local(stack, value().pair_car()); }
+    local_t Local::pair_cdr() { return Local(stack, value().pair_cdr()); }
+    void Local::pair_setcar(Local x) { value().pair_setcar(x.value()); }
+    void Local::pair_setcdr(Local x) { value().pair_setcdr(x.value()); }
+    size_t Local::vec_value_capacity() { return value().vec_value_capacity(); }
+    local_t Local::vec_fetch(uintptr_t i) { return Local(stack, value().vec_fetch(i)); }
+    void Local::vec_store(uintptr_t i, Local x) { value().vec_store(i, x.value()); }
+    size_t Local::bvl_byte_capacity() { return value().bvl_byte_capacity(); }
+    uint8_t Local::bvl_get(uintptr_t i) { return value().bvl_get(i); }
+    void Local::bvl_set(uintptr_t i, uint8_t x) { value().bvl_set(i, x); }
+    Bytes Local::bvl_raw() { return value().bvl_raw(); }
+    size_t Local::blob_val_capacity() { return value().blob_val_capacity(); }
+    size_t Local::blob_raw_capacity() { return value().blob_raw_capacity(); }
+    local_t Local::blob_fetch(uintptr_t i) { return Local(stack, value().blob_fetch(i)); }
+    void Local::blob_store(uintptr_t i, Local x) { value().blob_store(i, x.value()); }
+    uint8_t Local::blob_get(uintptr_t i) { return value().blob_get(i); }
+    void Local::blob_set(uintptr_t i, uint8_t x) { value().blob_set(i, x); }
+    Bytes Local::blob_raw() { return value().blob_raw(); }
+    size_t Local::record_slots() { return value().record_slots(); }
+    local_t Local::record_fetch(uintptr_t i) { return Local(stack, value().record_fetch(i)); }
+    void Local::record_store(uintptr_t i, Local x) { value().record_store(i, x.value()); }
+    uintptr_t Local::record_get(uintptr_t i) { return value().record_get(i); }
+    void Local::record_set(uintptr_t i, uintptr_t x) { value().record_set(i, x); }
+    size_t Local::nvec_length() { return value().nvec_length(); }
+    local_t Local::nvec_fetch(uintptr_t i) { return Local(stack, value().nvec_fetch(i)); }
+    void Local::nvec_store(uintptr_t i, Local x) { value().nvec_store(i, x.value()); }
+
+    // Reserve the whole stack at once, without committing memory to it,
+    // so that it can grow without moving.
+    void RootStack::reserve() {
+        size_t bytes = capacity * sizeof(tagged_t);
+        void *m = mmap(0, bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        assert(m != MAP_FAILED); // GUMP: assume the reservation succeeds
+        this->base = this->top = (tagged_t*) m;
+        this->end = this->base + capacity;
+    }
+
+    RootStack::~RootStack() {
+        if (this->base)
+            munmap(this->base, capacity * sizeof(tagged_t));
+    }
+
+    uint8_t *Cards::table = 0;
+    uintptr_t Cards::base = 0;
+    size_t Cards::size = 0;
+
+    bool Satb::active = false;
+    uintptr_t *Satb::base = 0;
+    uintptr_t *Satb::top = 0;
+    uintptr_t *Satb::end = 0;
+
+    void Satb::grow() {
+        size_t n = end - base, used = top - base;
+        n = n ? 2 * n : 1024;
+        base = (uintptr_t*) realloc(base, n * sizeof(uintptr_t));
+        assert(base != 0); // GUMP: assume mallocs don't fail
+        top = base + used;
+        end = base + n;
+    }
+
+    Space::Space()
+        : cursor(0), limit(0), roots(0, 0, constants::Literal_void),
+          stack_hi(0), pins(0), regions(0), interns(0) {}
+
+    void Space::visit_roots(RootVisitor &v) {
+        for (Handle *h = this->roots.prev; h; h = h->prev)
+            v.visit((uintptr_t*) &h->value);
+        for (Handle *h = const_cast<Handle*>(this->roots.next); h;
+             h = const_cast<Handle*>(h->next))
+            v.visit((uintptr_t*) &h->value);
+        for (tagged_t *l = this->locals.base; l < this->locals.top; l++)
+            v.visit((uintptr_t*) l);
+        for (RootRegion *r = this->regions; r; r = r->next_region)
+            r->visit_refs(v);
+    }
+
+    void Space::add_region(RootRegion *r) {
+        r->next_region = this->regions;
+        this->regions = r;
+    }
+
+    void Space::remove_region(RootRegion *r) {
+        RootRegion **l = &this->regions;
+        while (*l != r)
+            l = &(*l)->next_region;
+        *l = r->next_region;
+        r->next_region = 0;
+    }
+
+    void Space::set_conservative_roots(bool on) {
+        this->stack_hi = 0;
+        if (!on)
+            return;
+        pthread_attr_t attr;
+        void *lo;
+        size_t size;
+        int err = pthread_getattr_np(pthread_self(), &attr);
+        assert(err == 0);
+        err = pthread_attr_getstack(&attr, &lo, &size);
+        assert(err == 0);
+        pthread_attr_destroy(&attr);
+        this->stack_hi = (uintptr_t*) ((char*) lo + size);
+    }
+
+    // Out of line, so that its frame lies below every frame (and every
+    // spilled register) of its callers.
+    static void __attribute__((noinline))
+    scan_stack(uintptr_t *hi, AmbiguousVisitor &v) {
+        for (uintptr_t *w = (uintptr_t*) __builtin_frame_address(0); w < hi; w++)
+            v.visit(*w);
+    }
+
+    void Space::visit_stack(AmbiguousVisitor &v) {
+        if (this->stack_hi == 0)
+            return;
+        __builtin_unwind_init(); // spill the callee-saved registers
+        scan_stack(this->stack_hi, v);
+        __asm__ __volatile__("" ::: "memory"); // and keep this frame up
+    }
+
+    void Space::visit_pins(AmbiguousVisitor &v) {
+        for (Pin *p = this->pins; p; p = p->next)
+            v.visit(p->held.uint());
+    }
+
+    void Space::sweep_weak(WeakVisitor &v) {
+        if (this->interns)
+            this->interns->sweep(v);
+    }
+
+    static Bytes raw_of(handle_t &h) {
+        assert(h.is_bvl() || h.is_blob());
+        return h.is_blob() ? h.blob_raw() : h.bvl_raw();
+    }
+
+    Pin::Pin(Space &s, handle_t const& h)
+        : space(&s), prev(0), next(s.pins), held(h), raw(raw_of(this->held)) {
+        if (this->next)
+            this->next->prev = this;
+        s.pins = this;
+    }
 
-    namespace headers {
-        nym_t ref('r','e','f');
-        nym_t  pr('_','p','r'); nym_t pair = pr;
-        nym_t cns('c','n','s'); nym_t cons = cns;
-        nym_t snc('s','n','c'); nym_t snoc = snc;
-        nym_t vec('v','e','c'); nym_t vectorlike = vec;
-        nym_t bvl('b','v','l'); nym_t bytevectorlike = bvl;
-        nym_t rcd('r','c','d'); nym_t record = rcd;
-        nym_t blb('b','l','b'); nym_t blob = blb;
-        nym_t bsq('b','s','q'); nym_t bit_seq = bsq;
-        nym_t seq('s','e','q');
-        nym_t lst('l','s','t'); nym_t list = lst;
-        nym_t deq('d','e','q'); nym_t deque = deq;
-        nym_t fcn('f','c','n'); nym_t function = fcn;
+    Pin::~Pin() {
+        if (this->prev)
+            this->prev->next = this->next;
+        else
+            this->space->pins = this->next;
+        if (this->next)
+            this->next->prev = this->prev;
     }
 
-    Space::Space() : next(0) {}
+    void Space::print_roots() {
+        for (Handle *h = this->roots.prev; h; h = h->prev)
+            std::cout << "    root " << *h << "\n";
+        for (const Handle *h = this->roots.next; h; h = h->next)
+            std::cout << "    root " << *h << "\n";
+        for (tagged_t *l = this->locals.base; l < this->locals.top; l++)
+            std::cout << "    local " << *(Word*) l << "\n";
+    }
 
     handle_t Space::null() {
-        Handle h(0, this->next, constants::Literal_null);
-        this->next = &h;
-        return h;
+        return Handle(this->roots, constants::Literal_null);
     }
 
-    handle_t Space::cons(core::atom_t ar, core::handle_t dr) {
+    template <typename A, typename D>
+    tagged_t Space::make_pair(A& ar, D& dr) {
         if (dr.is_seq()) {
             // 1. gc-allocate 2-word-seq s; s[0] = ar; s[1] = dr.value
-            // 2. create a consref to S
-            // 3. return handle for the consref
-            void* s = this->gcalloc(ar, dr.value);
-            Handle h(0, this->next, Ref(uintptr_t(s), Word::konsref));
-            dbmsgln("cons gcalloced", " s:", s, " h:", h);
-            return h;
+            // 2. return a consref to S
+            tagged_t* s = (tagged_t*) this->gcalloc(constants::Literal_void, 2);
+            s[0] = value_of(ar);
+            s[1] = value_of(dr);
+            return Ref(uintptr_t(s), Word::konsref);
         } else {
             // 1. gc-allocate 3-word-seq S; 
             //    S[0] = headers::pair, S[1] = ar; S[2] = dr.value
-            // 2. create a valref to S
-            // 3. return handle for the valref
-            void* s = this->gcalloc(headers::pair, 3);
-            ((tagged_t*)s)[1] = ar;
-            ((tagged_t*)s)[2] = dr.value;
-            Handle h(0, this->next, Ref(uintptr_t(s), Word::valref));
-            dbmsgln("cons gcalloced", " s:", s, " h:", h);
-            return h;
+            // 2. return a valref to S
+            void* s = this->gcalloc(Header::vec(headers::pair, 2), 3);
+            ((tagged_t*)s)[1] = value_of(ar);
+            ((tagged_t*)s)[2] = value_of(dr);
+            return Ref(uintptr_t(s), Word::valref);
+        }
+    }
+
+    handle_t Space::cons(handle_t ar, handle_t dr) { return Handle(roots, make_pair(ar, dr)); }
+    handle_t Space::cons(atom_t ar, handle_t dr) { return Handle(roots, make_pair(ar, dr)); }
+    handle_t Space::cons(handle_t ar, atom_t dr) { return Handle(roots, make_pair(ar, dr)); }
+    handle_t Space::cons(atom_t ar, atom_t dr) { return Handle(roots, make_pair(ar, dr)); }
+
+    local_t Space::cons(local_t ar, local_t dr) { return Local(&locals, make_pair(ar, dr)); }
+    local_t Space::cons(atom_t ar, local_t dr) { return Local(&locals, make_pair(ar, dr)); }
+    local_t Space::cons(local_t ar, atom_t dr) { return Local(&locals, make_pair(ar, dr)); }
+    local_t Space::local(handle_t const& h) { return Local(&locals, h.value); }
+    local_t Space::local(atom_t a) { return Local(&locals, a); }
+    tagged_t Space::cons_raw(tagged_t ar, tagged_t dr) { return make_pair(ar, dr); }
+
+    tagged_t* Space::alloc_run(size_t n) {
+        size_t l = n + 2, ext = l >= Header::vec_lmax ? 1 : 0;
+        uintptr_t *m = (uintptr_t*) this->gcalloc(Header::vec(headers::run, l), 1 + ext + l);
+        if (ext)
+            m[1] = l << 2;
+        m[1 + ext + n] = Header::run_end(1 + ext + n);
+        return (tagged_t*) (m + 1 + ext);
+    }
+
+    template <typename V>
+    tagged_t Space::alloc_vec(nym_t h, size_t num_vals, V const& val) {
+        size_t ext = num_vals >= Header::vec_lmax ? 1 : 0;
+        uintptr_t *m = (uintptr_t*) this->gcalloc(Header::vec(h, num_vals), 1 + ext + num_vals);
+        if (ext)
+            m[1] = num_vals << 2;
+        uintptr_t v = value_of(val).uint();
+        for (size_t i = 0; i < num_vals; i++)
+            m[1 + ext + i] = v;
+        return Ref(uintptr_t(m), Word::valref);
+    }
+
+    template <typename V>
+    tagged_t Space::alloc_blob(nym_t h, size_t num_vals, V const& val, size_t num_bytes) {
+        size_t ext = num_vals >= Header::blob_lmax || num_bytes >= Header::blob_kmax ? 2 : 0;
+        size_t mdr = 1 + ext + num_vals;
+        size_t raw = (num_bytes + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+        uintptr_t *m = (uintptr_t*) this->gcalloc_raw(Header::blob(h, num_vals, num_bytes),
+                                                      mdr + 1 + raw, mdr + 1);
+        if (ext) {
+            m[1] = num_vals << 2;
+            m[2] = num_bytes << 2;
         }
+        uintptr_t v = value_of(val).uint();
+        for (size_t i = 0; i < num_vals; i++)
+            m[1 + ext + i] = v;
+        m[mdr] = Header::midder(mdr);
+        memset(m + mdr + 1, 0, raw * sizeof(uintptr_t));
+        return Ref(uintptr_t(m), Word::valref);
+    }
+
+    handle_t Space::make_vec(nym_t h, size_t num_vals, handle_t val) {
+        return Handle(this->roots, alloc_vec(h, num_vals, val));
+    }
+    handle_t Space::make_vec(nym_t h, size_t num_vals, Atom val) {
+        return Handle(this->roots, alloc_vec(h, num_vals, val));
     }
+
+    handle_t Space::make_bvl(nym_t h, size_t num_bytes) {
+        assert(h.code() != headers::rcd.code()); // records come from make_record
+        assert(h.code() != headers::nvc.code()); // and nvecs from make_nvec
+        size_t ext = num_bytes >= Header::bvl_kmax ? 1 : 0;
+        size_t raw = (num_bytes + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+        uintptr_t *m = (uintptr_t*) this->gcalloc_raw(Header::bvl(h, num_bytes),
+                                                      1 + ext + raw, 1 + ext);
+        if (ext)
+            m[1] = num_bytes << 2;
+        memset(m + 1 + ext, 0, raw * sizeof(uintptr_t));
+        return Handle(this->roots, Ref(uintptr_t(m), Word::valref));
+    }
+
+    handle_t Space::make_blob(nym_t h, size_t num_vals, handle_t val, size_t num_bytes) {
+        return Handle(this->roots, alloc_blob(h, num_vals, val, num_bytes));
+    }
+    handle_t Space::make_blob(nym_t h, size_t num_vals, Atom val, size_t num_bytes) {
+        return Handle(this->roots, alloc_blob(h, num_vals, val, num_bytes));
+    }
+
+    handle_t Space::make_list(size_t n, Atom val) {
+        assert(n > 0);
+        tagged_t *e = this->alloc_run(n);
+        for (size_t i = 0; i < n; i++)
+            e[i] = val;
+        e[n + 1] = constants::Literal_null;
+        return Handle(this->roots, run_ref(e));
+    }
+
+    handle_t Space::make_record(Layout const *l) {
+        size_t n = l->length(), bytes = (1 + n) * sizeof(uintptr_t);
+        size_t ext = bytes >= Header::bvl_kmax ? 1 : 0;
+        uintptr_t *m = (uintptr_t*) this->gcalloc_raw(Header::bvl(headers::rcd, bytes),
+                                                      2 + ext + n, 1 + ext);
+        if (ext)
+            m[1] = bytes << 2;
+        m[1 + ext] = uintptr_t(l);
+        for (size_t i = 0; i < n; i++)
+            m[2 + ext + i] = 0;
+        return Handle(this->roots, Ref(uintptr_t(m), Word::valref));
+    }
+
+    template <typename V>
+    tagged_t Space::alloc_nvec(size_t num_vals, V const& val) {
+        size_t bytes = num_vals * sizeof(uint32_t);
+        size_t ext = bytes >= Header::bvl_kmax ? 1 : 0;
+        size_t raw = (bytes + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+        uintptr_t *m = (uintptr_t*) this->gcalloc_raw(Header::bvl(headers::nvc, bytes),
+                                                      1 + ext + raw, 1 + ext);
+        if (ext)
+            m[1] = bytes << 2;
+        if (raw) // the last word's spare half, if any, too
+            m[ext + raw] = 0;
+        uint32_t v = Narrow::encode(value_of(val).uint());
+        for (size_t i = 0; i < num_vals; i++)
+            ((uint32_t*) (m + 1 + ext))[i] = v;
+        return Ref(uintptr_t(m), Word::valref);
+    }
+
+    handle_t Space::make_nvec(size_t num_vals, handle_t val) {
+        return Handle(this->roots, alloc_nvec(num_vals, val));
+    }
+    handle_t Space::make_nvec(size_t num_vals, Atom val) {
+        return Handle(this->roots, alloc_nvec(num_vals, val));
+    }
+
+    tagged_t Space::run_ref(tagged_t *e) { return Ref(uintptr_t(e), Word::snokref); }
 }
@@ -6,14 +6,20 @@
 #define CORE_H_INCLUDED
 
 #include <iostream>
+#include <string.h>
 
 namespace core {
 
     typedef size_t word_offset_t;
     typedef size_t byte_offset_t;
 
+    class Bytes;
+
 #ifndef CTORS_H_INCLUDED
 #error "val.h requires previous include: ctors.h"
+#endif
+#ifndef TRACE_H_INCLUDED
+#error "core.h requires previous include: trace.h"
 #endif
 
     template <size_t n> class WordBut;
@@ -24,6 +30,7 @@ namespace core {
         friend class WordBut<3>;
         friend class WordBut<4>;
         friend class WordBut<5>;
+        friend class Header;
 
     public:
         // The denotations of these names are explained in the comment
@@ -33,30 +40,19 @@ namespace core {
                        literal, fixnum };
         typedef Variant variant_t;
 
-        variant_t variant() {
-            // These numbers are explained in the table in the comment
-            // below the function definition.
-            switch (val & 0x7) {
-            case 3: return snokref;
-            case 1: return konsref;
-            case 5: return valref;
-            case 7: return intrref;
-
-            case 2: case 6: {
-                switch (val & 0x1f) {
-                case 0x0a:            return blobmdr;
-                case 0x06: case 0x16: return blobhdr;
-                case 0x02: case 0x12: return vechdr;
-                case 0x0e: case 0x1e: return bvlhdr;
-                case 0x1a:            return literal;
-                default:            assert(0);
-                }
-            }
+        constexpr variant_t variant() const { return variant_of(val); }
 
-            case 0: case 4: return fixnum;
-            }
-            assert(0);
+        // One table lookup on the low five bits, which always decide the
+        // variant (see the table below); every entry is a valid variant.
+        static constexpr variant_t variant_of(uintptr_t val) {
+            return variant_t(variant_table[val & 0x1f]);
         }
+        static constexpr uint8_t variant_table[32] = {
+            fixnum, konsref, vechdr,  snokref, fixnum, valref, blobhdr, intrref,
+            fixnum, konsref, blobmdr, snokref, fixnum, valref, bvlhdr,  intrref,
+            fixnum, konsref, vechdr,  snokref, fixnum, valref, blobhdr, intrref,
+            fixnum, konsref, literal, snokref, fixnum, valref, bvlhdr,  intrref,
+        };
 
         // Word format: (we assume a 32-bit word minimum).
         //
@@ -90,7 +86,9 @@ namespace core {
         // - intrref is ptr into tagged portion of object; scan up for header,
         // - valref is ptr to a header (or midder for a blob),
         // - konsref is ptr to a list (rest); interpret self as [head] ++ rest,
-        // - snokref is ptr to a list (prev); interpret self as prev ++ [last].
+        // - snokref is ptr into a cdr-coded run (see below); interpret self
+        //   as [head] ++ rest, where rest is the next cell of the run or,
+        //   past the run's end marker, the run's own cdr.
         //
         // All of the -hdr's are the starting word for a heap object.
         // The length of the object is *either* encoded in the header
@@ -107,18 +105,25 @@ namespace core {
         // Note also that the lengths encoded in the headers does not
         // include the space for the header (or middler, or auxiliary
         // length fields).
+        //
+        // A cdr-coded run is a vec (nym "run") holding the elements of
+        // a list side by side, then an end marker, then the cdr of the
+        // last element: [hdr, e_0, ..., e_n-1, end, cdr].  Its cells
+        // are snokrefs to the elements; the end marker has the format
+        // of a blobmdr (counting back to the header), so it is never
+        // mistaken for an element.
 
     protected:
-        Word(uintptr_t w) : val(w) {}
+        constexpr Word(uintptr_t w) : val(w) {}
 
     public:
-        uintptr_t uint() const { return val; }
+        constexpr uintptr_t uint() const { return val; }
     protected:
         uintptr_t val;
 
         NO_NULL_CTOR(Word);
     public:
-        Word(Word const &x) : val(x.val) {}
+        constexpr Word(Word const &x) : val(x.val) {}
         Word operator<<(intptr_t x) { return Word(val << x); }
         Word operator>>(intptr_t x) { return Word(val >> x); }
         Word operator&(uintptr_t x) { return Word(val & x); }
@@ -131,13 +136,13 @@ namespace core {
 
     template <size_t n>
     class WordBut {
-        static bool tagbitsclear(uintptr_t w) {
+        static constexpr bool tagbitsclear(uintptr_t w) {
             return (w >> (sizeof(uintptr_t)*8 - n)) == 0;
         }
     public:
-        WordBut(uintptr_t w) : content(w) { assert(tagbitsclear(w)); }
+        constexpr WordBut(uintptr_t w) : content(w) { assert(tagbitsclear(w)); }
     public:
-        Word tag(uintptr_t t) { assert((t >> n) == 0);
+        constexpr Word tag(uintptr_t t) const { assert((t >> n) == 0);
             return Word(content << n | t);
         }
         NO_NULL_CTOR(WordBut);
@@ -149,7 +154,7 @@ namespace core {
     class Content4 : public WordBut<4> { };
     class Content5 : public WordBut<5> {
     public:
-        Content5(uintptr_t c) : WordBut(c) { }
+        constexpr Content5(uintptr_t c) : WordBut(c) { }
     };
 
 #define DECLARE_BOOL_METHODS(MyType)                    \
@@ -179,6 +184,7 @@ namespace core {
     size_t  bvl_byte_capacity(); /* number of bytes */                  \
     uint8_t bvl_get(uintptr_t i); /* req. i < capacity */               \
     void    bvl_set(uintptr_t i, uint8_t x); /* req. i < capacity */    \
+    Bytes   bvl_raw(); /* all the bytes at once (see Bytes) */         \
     /* END BVL METHODS */
 
 #define DECLARE_BLOB_METHODS(MyType)                                    \
@@ -189,39 +195,62 @@ namespace core {
     void    blob_store(uintptr_t i, MyType x); /* req. i < val_capacity */ \
     uint8_t blob_get(uintptr_t i);   /* req. i < byte_capacity */       \
     void    blob_set(uintptr_t i, uint8_t x); /* req. i < raw_capacity */ \
+    Bytes   blob_raw(); /* all the raw bytes at once (see Bytes) */     \
     /* END BLOB METHODS */
 
+#define DECLARE_NVEC_METHODS(MyType)                                    \
+    /* Narrow vec primops (req. this is nvec [see Narrow]) */           \
+    size_t nvec_length();                                               \
+    MyType nvec_fetch(uintptr_t i); /* req. i < length */               \
+    void   nvec_store(uintptr_t i, MyType x); /* and Narrow::fits(x) */ \
+    /* END NVEC METHODS */
+
+#define DECLARE_RECORD_METHODS(MyType)                                  \
+    /* Record primops (req. this is record [see Layout]) */             \
+    size_t    record_slots();                                           \
+    MyType    record_fetch(uintptr_t i); /* req. slot i not nonptr */   \
+    void      record_store(uintptr_t i, MyType x); /* likewise */       \
+    uintptr_t record_get(uintptr_t i); /* req. slot i nonptr/farptr */  \
+    void      record_set(uintptr_t i, uintptr_t x); /* likewise */      \
+    /* END RECORD METHODS */
+
 #define DECLARE_PRIMOP_METHODS(MyType)                                  \
-    bool is_bool(); /* never fails; true for boolean (#t, #f)  */       \
-    bool truth();  /* never fails; false solely for #f */               \
+    bool is_bool() const; /* never fails; true for boolean (#t, #f) */  \
+    bool truth() const;  /* never fails; false solely for #f */         \
     DECLARE_BOOL_METHODS(MyType)                                        \
                                                                         \
     /* Dynamically-checked primops. */                                  \
                                                                         \
-    bool is_fixint();                                                   \
+    bool is_fixint() const;                                             \
     /* requires: this is fixint. */                                     \
-    intptr_t fixint_value();                                            \
+    intptr_t fixint_value() const;                                      \
                                                                         \
     /* requires: this is heap allocated.  Includes header (if any).  */ \
     size_t allocated_length();                                          \
                                                                         \
-    bool is_null(); /* infallible; true solely for #null. */            \
-    bool is_void(); /* infallible; true solely for #void. */            \
-    bool is_kons(); /* infallible; true solely for konsref */           \
-    bool is_snok(); /* infallible; true solely for snokref */           \
-    bool is_seq();  /* infallible; true for #null konsref + snokref  */ \
-    bool is_pair(); /* infallible; true for kons/snok/val<_pr> ref  */  \
+    bool is_null() const; /* infallible; true solely for #null. */      \
+    bool is_void() const; /* infallible; true solely for #void. */      \
+    bool is_kons() const; /* infallible; true solely for konsref */     \
+    bool is_snok() const; /* infallible; true solely for snokref */     \
+    bool is_seq() const;  /* infallible; true for #null kons + snok */  \
+    bool is_pair() const; /* infallible; true for kons/snok/val<_pr> */ \
     DECLARE_SEQ_METHODS(MyType)                                         \
     DECLARE_PAIR_METHODS(MyType)                                        \
                                                                         \
-    bool is_vec();                                                      \
+    bool is_vec() const;                                                \
     DECLARE_VEC_METHODS(MyType)                                         \
                                                                         \
-    bool is_bvl();                                                      \
+    bool is_bvl() const;                                                \
     DECLARE_BVL_METHODS(MyType)                                         \
                                                                         \
-    bool is_blob();                                                     \
+    bool is_blob() const;                                               \
     DECLARE_BLOB_METHODS(MyType)                                        \
+                                                                        \
+    bool is_record() const;                                             \
+    DECLARE_RECORD_METHODS(MyType)                                      \
+                                                                        \
+    bool is_nvec() const;                                               \
+    DECLARE_NVEC_METHODS(MyType)                                        \
     /* END OF PRIM OP LIST */
 
 #define DECLARE_WORD_ORIENTED_RAW_ACCESSORS() \
@@ -255,11 +284,11 @@ namespace core {
     class Formatted : protected Word
     {
     protected:
-        Formatted(word_t w) : Word(w) {}
+        constexpr Formatted(word_t w) : Word(w) {}
 
         NO_NULL_CTOR(Formatted);
     public:
-        Formatted(Formatted const &x) : Word(x) {}
+        constexpr Formatted(Formatted const &x) : Word(x) {}
     };
     typedef Formatted formatted_t;
 
@@ -268,13 +297,13 @@ namespace core {
     public:
         DECLARE_PRIMOP_METHODS(Tagged);
     protected:
-        Tagged(word_t w);
+        constexpr Tagged(word_t w) : Formatted(w) {}
 
         NO_NULL_CTOR(Tagged);
     public:
-        Tagged(Tagged const &x);
+        constexpr Tagged(Tagged const &x) : Formatted(x) {}
     public:
-        uintptr_t uint() const { return Word::uint(); }
+        constexpr uintptr_t uint() const { return Word::uint(); }
     };
     typedef Tagged tagged_t;
 
@@ -284,7 +313,7 @@ namespace core {
     //
     class Nym : public Formatted {
     private:
-        static uintptr_t encode(char a, char b, char c) {
+        static constexpr uintptr_t encode(char a, char b, char c) {
             assert(a <= 122);
             assert(a >= 91);
             assert(b <= 122);
@@ -300,37 +329,280 @@ namespace core {
             result[0] = char(((x >> 10) & 0x1f) + 91);
             return result;
         }
-        uintptr_t tag(char a, char b, char c) { return encode(a,b,c) << 2; }
+        static constexpr uintptr_t tag(char a, char b, char c) {
+            return encode(a,b,c) << 2;
+        }
     public:
-        char* decode() { return decode(val >> 2); }
+        char* decode() const { return decode(val >> 2); }
+        constexpr uintptr_t code() const { return val >> 2; }
         NO_NULL_CTOR(Nym);
     public:
-        Nym(char a, char b, char c) : Formatted(tag(a,b,c)) {}
-        Nym(Nym const&x) : Formatted(x) {}
+        constexpr Nym(char a, char b, char c) : Formatted(tag(a,b,c)) {}
+        constexpr Nym(Nym const&x) : Formatted(x) {}
+        // The nym whose code() is c (as read out of a header).
+        static constexpr Nym of_code(uintptr_t c) {
+            return Nym(char(((c >> 10) & 0x1f) + 91), char(((c >> 5) & 0x1f) + 91),
+                       char((c & 0x1f) + 91));
+        }
     };
     typedef Nym nym_t;
 
     namespace headers {
         // nym_t are used both as headers and to express class relationships.
-        extern nym_t 
-            pr, pair,
-            vec, vectorlike, bvl, bytevectorlike, atm, rcd, record, blb, blob, bsq, bit_seq;
+        constexpr nym_t ref('r','e','f');
+        constexpr nym_t  pr('_','p','r'); constexpr nym_t pair = pr;
+        constexpr nym_t cns('c','n','s'); constexpr nym_t cons = cns;
+        constexpr nym_t snc('s','n','c'); constexpr nym_t snoc = snc;
+        constexpr nym_t vec('v','e','c'); constexpr nym_t vectorlike = vec;
+        constexpr nym_t bvl('b','v','l'); constexpr nym_t bytevectorlike = bvl;
+        constexpr nym_t rcd('r','c','d'); constexpr nym_t record = rcd;
+        constexpr nym_t blb('b','l','b'); constexpr nym_t blob = blb;
+        constexpr nym_t bsq('b','s','q'); constexpr nym_t bit_seq = bsq;
+        constexpr nym_t seq('s','e','q');
+        constexpr nym_t lst('l','s','t'); constexpr nym_t list = lst;
+        constexpr nym_t deq('d','e','q'); constexpr nym_t deque = deq;
+        constexpr nym_t fcn('f','c','n'); constexpr nym_t function = fcn;
+        constexpr nym_t run('r','u','n'); constexpr nym_t cdr_run = run;
+        constexpr nym_t pad('p','a','d'); constexpr nym_t filler = pad;
+        constexpr nym_t nvc('n','v','c'); constexpr nym_t narrow_vec = nvc;
     }
 
+    // A header is the formatted word that starts every heap object
+    // other than a header-less pair; see the table below
+    // Word::variant().  The nym sits above the length fields.  A length
+    // field of all ones means the length did not fit, and is instead
+    // held (as a fixnum) in the following word, or two words for a
+    // blob, whose value-word length comes first.
+    //
+    // The static decoders work on raw words, since that is how the
+    // collector sees the heap; p always points at the header word.
+    class Header : public Formatted {
+    public:
+        static const unsigned nym_shift = 17;
+        static const uintptr_t vec_lmax  = 0x1fff; // 13 bits at bit 4
+        static const uintptr_t bvl_kmax  = 0x1fff; // 13 bits at bit 4
+        static const uintptr_t blob_kmax = 0xff;   //  8 bits at bit 4
+        static const uintptr_t blob_lmax = 0x1f;   //  5 bits at bit 12
+
+        static constexpr Header vec(nym_t n, size_t words) {
+            uintptr_t l = words < vec_lmax ? words : vec_lmax;
+            return Header(n.code() << nym_shift | l << 4 | 0x2);
+        }
+        static constexpr Header bvl(nym_t n, size_t bytes) {
+            uintptr_t k = bytes < bvl_kmax ? bytes : bvl_kmax;
+            return Header(n.code() << nym_shift | k << 4 | 0xe);
+        }
+        static constexpr Header blob(nym_t n, size_t words, size_t bytes) {
+            if (words >= blob_lmax || bytes >= blob_kmax)
+                words = blob_lmax, bytes = blob_kmax;
+            return Header(n.code() << nym_shift | words << 12 | bytes << 4 | 0x6);
+        }
+        // The interior marker of a blob, delta words below its header.
+        static constexpr uintptr_t midder(size_t delta) { return delta << 5 | 0x0a; }
+        static constexpr size_t midder_delta(uintptr_t w) { return w >> 5; }
+        // The end marker of a cdr-coded run, delta words below its header.
+        static constexpr uintptr_t run_end(size_t delta) { return midder(delta); }
+        static constexpr bool is_run_end(uintptr_t w) { return (w & 0x1f) == 0x0a; }
+
+        static constexpr bool is_header(uintptr_t w) {
+            switch (w & 0xf) {
+            case 0x2: case 0x6: case 0xe: return true;
+            default: return false;
+            }
+        }
+        static constexpr uintptr_t nym_code(uintptr_t w) { return (w >> nym_shift) & 0x7fff; }
+        // A record is a bvl of nym rcd (see Layout).
+        static constexpr bool is_record(uintptr_t w) {
+            return (w & 0xf) == 0xe && nym_code(w) == headers::rcd.code();
+        }
+        // A narrow vec is a bvl of nym nvc (see Narrow).
+        static constexpr bool is_nvec(uintptr_t w) {
+            return (w & 0xf) == 0xe && nym_code(w) == headers::nvc.code();
+        }
+
+        // Number of length words between the header and the values.
+        static size_t extension_words(uintptr_t w) {
+            switch (variant_of(w)) {
+            case vechdr:  return ((w >> 4) & vec_lmax) == vec_lmax ? 1 : 0;
+            case bvlhdr:  return ((w >> 4) & bvl_kmax) == bvl_kmax ? 1 : 0;
+            case blobhdr: return ((w >> 12) & blob_lmax) == blob_lmax ? 2 : 0;
+            default: assert(0);
+            }
+        }
+        // l: number of tagged value words (zero for a bvl).
+        static size_t value_words(const uintptr_t *p) {
+            uintptr_t w = p[0];
+            switch (variant_of(w)) {
+            case vechdr: {
+                uintptr_t l = (w >> 4) & vec_lmax;
+                return l == vec_lmax ? p[1] >> 2 : l;
+            }
+            case blobhdr: {
+                uintptr_t l = (w >> 12) & blob_lmax;
+                return l == blob_lmax ? p[1] >> 2 : l;
+            }
+            case bvlhdr: return 0;
+            default: assert(0);
+            }
+        }
+        // k: number of raw bytes (zero for a vec).
+        static size_t raw_bytes(const uintptr_t *p) {
+            uintptr_t w = p[0];
+            switch (variant_of(w)) {
+            case bvlhdr: {
+                uintptr_t k = (w >> 4) & bvl_kmax;
+                return k == bvl_kmax ? p[1] >> 2 : k;
+            }
+            case blobhdr: {
+                uintptr_t l = (w >> 12) & blob_lmax;
+                return l == blob_lmax ? p[2] >> 2 : (w >> 4) & blob_kmax;
+            }
+            case vechdr: return 0;
+            default: assert(0);
+            }
+        }
+        // Index of the first value word.
+        static size_t first_value(const uintptr_t *p) {
+            return 1 + extension_words(p[0]);
+        }
+        // The whole object: header, length words, values, the midder
+        // of a blob, and the raw bytes rounded up to whole words.
+        static size_t object_words(const uintptr_t *p) {
+            size_t raw = (raw_bytes(p) + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+            size_t mdr = variant_of(p[0]) == blobhdr ? 1 : 0;
+            return first_value(p) + value_words(p) + mdr + raw;
+        }
+        // Index of the first raw word of a bvl or blob.
+        static size_t first_raw(const uintptr_t *p) {
+            size_t i = first_value(p);
+            return variant_of(p[0]) == blobhdr ? i + value_words(p) + 1 : i;
+        }
+
+        // The raw bytes of every bvl and blob start on a boundary of
+        // raw_align bytes (see Space::gcalloc_raw), so that bulk work
+        // on them can use aligned vector loads.  The word this costs
+        // becomes a filler, a bvl of nym pad and no bytes, which walkers
+        // of the heap parse as they would any other bvl.
+        static const size_t raw_align = 2 * sizeof(uintptr_t);
+        static constexpr uintptr_t filler() { return bvl(headers::pad, 0).val; }
+
+        // The header as the word stored at the front of its object.
+        constexpr uintptr_t uint() const { return Word::uint(); }
+
+    private:
+        constexpr Header(uintptr_t w) : Formatted(Word(w)) {}
+    };
+    typedef Header header_t;
+
+    // A narrow vec (nvec) holds its elements in 32 bits each, in the
+    // raw bytes of a bvl of nym nvc, for half the room of a vec.  An
+    // element is an atom cut to 32 bits: a fixnum of 30 bits or a
+    // literal of 27 (see fits), never a reference.  So collectors take
+    // an nvec for the bvl it is, and no copying can put what one holds
+    // out of its reach.
+    class Narrow {
+    public:
+        static uint32_t encode(uintptr_t w) {
+            assert(fits(w)); // GUMP: atoms of 32 bits only
+            return uint32_t(w);
+        }
+        static uintptr_t decode(uint32_t n) { return uintptr_t(intptr_t(int32_t(n))); }
+        // Whether w can be an element.
+        static bool fits(uintptr_t w) { return !(w & 0x1) && decode(uint32_t(w)) == w; }
+
+        // p points at the header.
+        static uint32_t* elements(uintptr_t *p) {
+            return (uint32_t*) (p + Header::first_value(p));
+        }
+        static size_t length(const uintptr_t *p) { return Header::raw_bytes(p) / 4; }
+    };
+
+    // Whole lanes of T over raw bytes that start on a raw_align
+    // boundary, for loops that the compiler can vectorize with aligned
+    // loads.
+    template <typename T>
+    class Lanes {
+    public:
+        Lanes(T *p, size_t n) : p(p), n(n) {}
+        size_t size() const { return this->n; }
+        T* begin() const { return (T*) __builtin_assume_aligned(this->p, Header::raw_align); }
+        T* end() const { return this->begin() + this->n; }
+        T& operator[](size_t i) const {
+            assert(i < this->n);
+            return this->begin()[i];
+        }
+    private:
+        T *p;
+        size_t n;
+    };
+
+    // The raw bytes of a bvl or blob, for work on many of them at once
+    // (see bvl_raw, blob_raw).  It holds their bare address, so it is
+    // good only until the next allocation in their space, which may
+    // move them, unless a Pin holds them in place.  Copying, filling,
+    // comparing and finding are the C library's, which does them a
+    // vector at a time.
+    class Bytes {
+    public:
+        Bytes(uint8_t *p, size_t n) : p(p), n(n) {}
+        size_t size() const { return this->n; }
+        uint8_t* data() const {
+            return (uint8_t*) __builtin_assume_aligned(this->p, Header::raw_align);
+        }
+
+        void fill(size_t i, size_t k, uint8_t x) {
+            assert(i + k <= this->n);
+            memset(this->p + i, x, k);
+        }
+        // k bytes of src from j, to here from i; the two may overlap.
+        void copy(size_t i, Bytes const& src, size_t j, size_t k) {
+            assert(i + k <= this->n && j + k <= src.n);
+            memmove(this->p + i, src.p + j, k);
+        }
+        // Negative, zero or positive as these bytes sort before, with or
+        // after those of b: byte by byte, then shorter first.
+        int compare(Bytes const& b) const {
+            int c = memcmp(this->p, b.p, this->n < b.n ? this->n : b.n);
+            return c ? c : (this->n > b.n) - (this->n < b.n);
+        }
+        // The index of the first x at or after from; size() if none.
+        size_t find(uint8_t x, size_t from = 0) const {
+            if (from >= this->n)
+                return this->n;
+            const void *q = memchr(this->p + from, x, this->n - from);
+            return q ? (const uint8_t*) q - this->p : this->n;
+        }
+        // As whole lanes of T; any bytes past the last whole lane are
+        // left out.
+        template <typename T>
+        Lanes<T> lanes() const { return Lanes<T>((T*) this->p, this->n / sizeof(T)); }
+
+    private:
+        uint8_t *p;
+        size_t n;
+    };
+
     // An atom-word (atm, atom) is a tagged self-contained word-sized value.
     class Atom : public Tagged {
     protected:
-        Atom(uintptr_t x) : Tagged(x) {}
+        constexpr Atom(uintptr_t x) : Tagged(x) {}
     protected:
-        Atom(word_t w) : Tagged(w) {}
+        constexpr Atom(word_t w) : Tagged(w) {}
 
         NO_NULL_CTOR(Atom);
     public:
-        Atom(Atom const &x) : Tagged(x) {}
+        constexpr Atom(Atom const &x) : Tagged(x) {}
     };
     typedef Atom atom_t;
 
     class Space;
+    class Layout;
+    class Pin;
+    class RootRegion;
+    class RootVisitor;
+    class AmbiguousVisitor;
+    class WeakVisitor;
+    class Interns;
     class Handle {
         friend class Space;
     public:
@@ -350,6 +622,7 @@ namespace core {
             if (h.prev) h.prev->next = this;
             h.prev = this;
             this->next = &h;
+            trace::record(trace::handle_link, this);
         }
 
         Handle(Handle const& h, tagged_t v) : value(v) {
@@ -357,9 +630,11 @@ namespace core {
             if (h.prev) h.prev->next = this;
             h.prev = this;
             this->next = &h;
+            trace::record(trace::handle_link, this);
         }
 
         ~Handle() {
+            trace::record(trace::handle_unlink, this);
             if (this->prev)
                 this->prev->next = this->next;
             if (this->next)
@@ -372,9 +647,112 @@ namespace core {
         Tagged value;
     public:
         uintptr_t uint() const { return value.uint(); }
+        // The bare value; nothing roots it but the conservative root
+        // mode (see Space::set_conservative_roots).
+        tagged_t raw() const { return value; }
     };
     typedef Handle handle_t;
 
+    // The slots behind Locals: one contiguous array per space, reserved
+    // up front so that slots never move, and used as a stack.  A
+    // HandleScope reserves it on first use.
+    class RootStack {
+        friend class Space;
+        friend class HandleScope;
+    public:
+        RootStack() : base(0), top(0), end(0) {}
+        ~RootStack();
+
+        tagged_t* push(tagged_t const& v) {
+            assert(this->top < this->end); // GUMP: scopes stay shallow
+            trace::record(trace::local_push, this->top);
+            *this->top = v;
+            return this->top++;
+        }
+
+        static const size_t capacity = size_t(1) << 20;
+    private:
+        void reserve();
+        tagged_t *base, *top, *end;
+
+        NO_COPY_CTOR(RootStack);
+    };
+
+    // A Local is the cheap alternative to a Handle: a slot on its
+    // space's root stack.  Making one is a single store at the top of
+    // the stack, with no neighbours to relink, and it is dropped along
+    // with every other Local of its HandleScope when that scope closes,
+    // so it must not outlive the scope.  As with handles, assignment
+    // copies the value into the slot already held; to carry a value
+    // out of a scope, assign it to a Local of an enclosing one.
+    class Local {
+        friend class Space;
+    public:
+        DECLARE_PRIMOP_METHODS(Local);
+
+        Local(Local const& x) : stack(x.stack), slot(x.stack->push(*x.slot)) {}
+        Local& operator=(Local const& x) {
+            *this->slot = *x.slot;
+            return *this;
+        }
+        uintptr_t uint() const { return this->slot->uint(); }
+        tagged_t raw() const { return *this->slot; }
+    private:
+        Local(RootStack *stack, tagged_t v) : stack(stack), slot(stack->push(v)) {}
+        tagged_t value() const { return *this->slot; }
+
+        RootStack *stack;
+        tagged_t *slot;
+    };
+    typedef Local local_t;
+
+    // The card table covers the whole heap reservation with one byte
+    // per card of 2^shift bytes.  Every store of a reference into a
+    // heap slot dirties the card holding the slot, so that collecting
+    // part of the heap can find the references into it from the rest
+    // without scanning the rest.  Until a heap is reserved, size is 0
+    // and marking is a no-op.
+    class Cards {
+    public:
+        static const unsigned shift = 9;
+        static const size_t bytes = size_t(1) << shift;
+
+        // Threads sharing a space may mark the same card at once (see
+        // spaces::SharedSpace): the store is atomic, though no dearer.
+        static void mark(const void *slot) {
+            uintptr_t off = uintptr_t(slot) - base;
+            if (off < size)
+                __atomic_store_n(&table[off >> shift], 1, __ATOMIC_RELAXED);
+        }
+
+        static uint8_t *table;
+        static uintptr_t base;
+        static size_t size;
+    };
+
+    // The snapshot-at-the-beginning log.  While a space is marking
+    // incrementally (one at a time), every store first logs the
+    // reference it is about to overwrite, and the marker shades what
+    // it finds in the log: so whatever was reachable when marking began
+    // is marked, however the mutator rearranges the heap meanwhile.
+    class Satb {
+    public:
+        static void log(uintptr_t old) {
+            if (!(old & 0x1)) // references are the odd tags
+                return;
+            if (top == end)
+                grow();
+            *top++ = old;
+        }
+        static bool empty() { return top == base; }
+        static uintptr_t pop() { return *--top; }
+
+        static bool active;
+    private:
+        static void grow();
+        static uintptr_t *base, *top, *end;
+    };
+
     // A space holds a collection of memory blocks, and also a set of
     // roots for the space.
     class Space {
@@ -389,6 +767,44 @@ namespace core {
         handle_t cons(handle_t ar, Atom dr);
         handle_t cons(Atom ar, Atom dr);
 
+        // The same, rooted on the root stack; these need an open
+        // HandleScope on this space.
+        local_t cons(local_t ar, local_t dr);
+        local_t cons(Atom ar, local_t dr);
+        local_t cons(local_t ar, Atom dr);
+        local_t local(handle_t const& h);
+        local_t local(Atom a);
+
+        // The same, unrooted: for the conservative root mode only.
+        tagged_t cons_raw(tagged_t ar, tagged_t dr);
+
+        // A list of the values in [begin, end) (handles or atoms), in
+        // front of tail: built as one cdr-coded run (see Word), in one
+        // allocation, so that it takes about half the words of a chain
+        // of conses and is walked by reading consecutive words.
+        template <typename It>
+        handle_t list_from(It begin, It end) {
+            return this->list_from(begin, end, this->null());
+        }
+        template <typename It>
+        handle_t list_from(It begin, It end, handle_t tail) {
+            assert(tail.is_seq());
+            size_t n = 0;
+            for (It i = begin; i != end; ++i)
+                n++;
+            if (n == 0)
+                return tail;
+            tagged_t *e = this->alloc_run(n);
+            for (size_t i = 0; i < n; i++, ++begin)
+                e[i] = value_of(*begin);
+            e[n + 1] = tail.value;
+            return Handle(this->roots, run_ref(e));
+        }
+
+        // A list of n copies of val (n > 0), as one run like those of
+        // list_from, to be filled in afterwards a car at a time.
+        handle_t make_list(size_t n, Atom val);
+
         handle_t snoc(handle_t ar, handle_t dr);
         handle_t snoc(Atom ar, handle_t dr);
         handle_t snoc(handle_t ar, Atom dr);
@@ -401,6 +817,41 @@ namespace core {
         handle_t make_blob(nym_t h, size_t num_vals, handle_t val, size_t num_bytes);
         handle_t make_blob(nym_t h, size_t num_vals, Atom val, size_t num_bytes);
 
+        // A record of l's slots, all zero: fixnum 0 in the tagged ones,
+        // null in the pointers.  l must outlive it.
+        handle_t make_record(Layout const *l);
+
+        // A narrow vec of num_vals copies of val (see Narrow); requires
+        // Narrow::fits(val).
+        handle_t make_nvec(size_t num_vals, handle_t val);
+        handle_t make_nvec(size_t num_vals, Atom val);
+
+        // Hash-consing, through the space's Interns (which must exist):
+        // the interned pair of ar and dr, made only if no equal one is
+        // interned already.  Pairs built alike from atoms and interned
+        // objects are then one, and compare by reference.
+        handle_t hcons(handle_t ar, handle_t dr);
+        handle_t hcons(Atom ar, handle_t dr);
+        handle_t hcons(handle_t ar, Atom dr);
+        handle_t hcons(Atom ar, Atom dr);
+
+        // The same for a vec of nym h holding the values in [begin, end)
+        // (handles or atoms).  The vec is made first, and dropped for
+        // an equal one if there is one.
+        template <typename It>
+        handle_t make_ivec(nym_t h, It begin, It end) {
+            assert(h.code() != headers::run.code());
+            size_t n = 0;
+            for (It i = begin; i != end; ++i)
+                n++;
+            handle_t v = this->make_vec(h, n, this->null());
+            uintptr_t *m = (uintptr_t*) (v.uint() & ~0x7);
+            tagged_t *e = (tagged_t*) (m + Header::first_value(m));
+            for (size_t i = 0; i < n; i++, ++begin)
+                e[i] = value_of(*begin);
+            return this->intern(v);
+        }
+
         handle_t null(); // even though this does not allocate heap-space,
         // we need to create a handle for #null so that it can be passed
         // in the same uniform manner to the other methods of Space.
@@ -430,9 +881,81 @@ namespace core {
     public:
         void print_roots();
 
-    private:
+        // Reclaim whatever the roots cannot reach.  The default space
+        // never reclaims anything.
+        virtual void collect() {}
+
+        // The conservative root mode: collections also take every word
+        // on the stack (and in the registers) of the thread that turned
+        // it on as a possible reference, so that code on that thread may
+        // hold raw values (Handle::raw, cons_raw) in its locals.  Whatever
+        // such a word might refer to is pinned where it is.
+        void set_conservative_roots(bool on);
+        bool conservative_roots() const { return this->stack_hi != 0; }
+
+        // Memory that no collector of the space owns but whose objects
+        // may come to refer into it (see RootRegion): every collection
+        // takes what the region reports as roots, until it is removed.
+        void add_region(RootRegion *r);
+        void remove_region(RootRegion *r);
+
+    protected:
+        // Every live handle of this space, presented as a raw word
+        // that the visitor may rewrite in place (e.g. to forward it).
+        void visit_roots(RootVisitor &v);
+        // In the conservative root mode, every word of the stack; a
+        // no-op otherwise.
+        void visit_stack(AmbiguousVisitor &v);
+        // The objects held by Pins: a collection that moves objects
+        // must leave these where they are.
+        void visit_pins(AmbiguousVisitor &v);
+        // What the space holds weakly (its Interns), once a collection
+        // knows what survived and has updated the survivors' fields.
+        virtual void sweep_weak(WeakVisitor &v);
+        // The table hcons and make_ivec go through.
+        virtual Interns* intern_table() { return this->interns; }
+
+    protected:
         // h, n       -> [h, x_2, x_3, ..., x_n] where x_i *unformatted*
-        virtual void* gcalloc(formatted_t h, size_t n) = 0;
+        //
+        // This is the allocation fast path: bump the cursor within the
+        // current buffer [cursor, limit).  Subclasses never override
+        // it; they supply buffers (or individual objects) via refill.
+        void* gcalloc(formatted_t h, size_t n) {
+            void *m = size_t(this->limit - this->cursor) < n ?
+                this->refill(h, n) : this->bump(h, n);
+            trace::record(trace::alloc, m, n);
+            return m;
+        }
+        // gcalloc from the current buffer, which must hold n words.
+        void* bump(formatted_t h, size_t n) {
+            formatted_t *m = this->cursor;
+            this->cursor = m + n;
+            m[0] = h;
+            return m;
+        }
+        // Slow path for gcalloc: the current buffer cannot hold n words.
+        // Must return n words with h stored in the first; may install a
+        // fresh [cursor, limit) buffer as a side-effect.
+        virtual void* refill(formatted_t h, size_t n) = 0;
+        // gcalloc for a bvl or blob whose raw bytes start raw words in:
+        // one word more, so as to put them on a raw_align boundary,
+        // with the spare word as a filler before or after the object.
+        void* gcalloc_raw(formatted_t h, size_t n, size_t raw) {
+            uintptr_t *m = (uintptr_t*) this->gcalloc(h, n + 1);
+            if ((uintptr_t(m + raw) & (Header::raw_align - 1)) == 0) {
+                m[n] = Header::filler();
+                return m;
+            }
+            m[0] = Header::filler();
+            ((formatted_t*) m)[1] = h;
+            return m + 1;
+        }
+        // gcalloc on s, or gcalloc_raw if raw is not 0: for a space
+        // that copies objects into another (see spaces::Promotion).
+        static void* gcalloc_on(Space &s, formatted_t h, size_t n, size_t raw) {
+            return raw ? s.gcalloc_raw(h, n, raw) : s.gcalloc(h, n);
+        }
         // h, w, n    -> [h, w_2, w_3, ..., w_n]
         virtual void* gcalloc(formatted_t a, word_t w, size_t n) {
             word_t *m = (word_t*) this->gcalloc(a, n);
@@ -445,8 +968,141 @@ namespace core {
             m[1] = b;
             return m;
         }
+    protected:
+        formatted_t *cursor; // next free word of the allocation buffer
+        formatted_t *limit;  // one past the last word of the buffer
+    private:
+        friend class HandleScope;
+        friend class Pin;
+
+        // Every handle of the space is linked into one chain through
+        // this sentinel (new handles are linked in just before it).
+        handle_t roots;
+        // Every Local of the space lies in [locals.base, locals.top).
+        RootStack locals;
+        // The top of the stack scanned in the conservative root mode;
+        // 0 when the mode is off.
+        uintptr_t *stack_hi;
+        // The open Pins on this space, most recent first.
+        Pin *pins;
+        // The regions added to this space, most recent first.
+        RootRegion *regions;
+        friend class Interns;
+        Interns *interns;
+
+        // Allocate a cons cell (or a _pr pair, for a non-seq dr).
+        // The inputs are only read once the cell exists, since the
+        // allocation may collect and move whatever they refer to.
+        template <typename A, typename D>
+        tagged_t make_pair(A& ar, D& dr);
+        // Allocate a vec or blob (with its length words, if the header
+        // cannot hold the lengths), filled with val (read once the
+        // object exists, as above); the raw bytes of a blob are zero.
+        template <typename V>
+        tagged_t alloc_vec(nym_t h, size_t num_vals, V const& val);
+        template <typename V>
+        tagged_t alloc_blob(nym_t h, size_t num_vals, V const& val, size_t num_bytes);
+        template <typename V>
+        tagged_t alloc_nvec(size_t num_vals, V const& val);
+        // Allocate a run of n elements, headed and end-marked; returns
+        // its first element, with the elements and cdr left to fill in.
+        tagged_t* alloc_run(size_t n);
+        static tagged_t run_ref(tagged_t *e);
+        // The interned object equal to v, a fresh pair or vec: v itself,
+        // unless one came first.
+        handle_t intern(handle_t const& v);
+        template <typename A, typename D>
+        handle_t intern_pair(A const& ar, D const& dr);
+        static tagged_t value_of(handle_t const& h) { return h.value; }
+        static tagged_t value_of(local_t const& l) { return l.value(); }
+        static tagged_t value_of(atom_t const& a) { return a; }
+        static tagged_t value_of(tagged_t const& t) { return t; }
+    };
+
+    // Collectors implement this to see (and update) the roots of a
+    // space; slot points at the raw word held by the root.
+    class RootVisitor {
+    public:
+        virtual void visit(uintptr_t *slot) = 0;
+    };
+
+    // Collectors implement this to tell what they left of an object
+    // held weakly, after tracing: w, a reference into the space, as it
+    // now refers, or 0 if its object is dead.
+    class WeakVisitor {
+    public:
+        virtual uintptr_t survivor(uintptr_t w) = 0;
+    };
+
+    // A region implements this to give a collection the slots of its
+    // objects that may refer into the space, as roots (which the
+    // visitor may rewrite in place, as for handles).
+    class RootRegion {
+    public:
+        RootRegion() : next_region(0) {}
+        virtual void visit_refs(RootVisitor &v) = 0;
+    protected:
+        ~RootRegion() {}
+    private:
+        friend class Space;
+        RootRegion *next_region;
+    };
+
+    // Collectors implement this to see the words of the stack in the
+    // conservative root mode.  Any word may or may not be a reference
+    // (tagged, or not), and must be left as it is.
+    class AmbiguousVisitor {
+    public:
+        virtual void visit(uintptr_t w) = 0;
+    };
+
+    // Opens a scope for Locals of a space: every Local made while it is
+    // open is dropped, in one store, when it closes.  Scopes nest, as
+    // the C++ scopes that hold them do.
+    class HandleScope {
+    public:
+        explicit HandleScope(Space &s) : stack(&s.locals) {
+            if (this->stack->base == 0)
+                this->stack->reserve();
+            this->saved = this->stack->top;
+        }
+        ~HandleScope() {
+            trace::record(trace::scope_close, this->saved,
+                          this->stack->top - this->saved);
+            this->stack->top = this->saved;
+        }
     private:
-        handle_t *next;
+        RootStack *stack;
+        tagged_t *saved;
+
+        NO_COPY_CTOR(HandleScope);
+    };
+
+    // Holds a bvl or blob in place for as long as it lives, so that its
+    // raw bytes stay at one address: a read(2) or recv(2) may fill them
+    // directly, and native code may use them, while the space goes on
+    // allocating and collecting.  The object is a root meanwhile.  A
+    // copying space keeps the whole block holding it where it is, as
+    // for a conservative root, so pins should be few and brief.  The
+    // pins of a space may close in any order.
+    class Pin {
+    public:
+        Pin(Space &s, handle_t const& h);
+        ~Pin();
+
+        Bytes const& bytes() const { return this->raw; }
+        uint8_t* data() const { return this->raw.data(); }
+        size_t size() const { return this->raw.size(); }
+
+    private:
+        friend class Space;
+
+        Space *space;
+        Pin *prev, *next;
+        handle_t held;
+        Bytes raw;
+
+        NO_COPY_CTOR(Pin);
     };
 
     // A ref-word (ref) is a tagged reference to another object.
@@ -458,12 +1114,12 @@ namespace core {
     class Ref : public Tagged {
         friend class Space;
     public:
-        static void checkaligned(uintptr_t x) { assert((x & 0x7) == 0); }
-        static intptr_t tagsnok(uintptr_t x) { return x | 0x3; }
-        static intptr_t tagkons(uintptr_t x) { return x | 0x1; }
-        static intptr_t  tagval(uintptr_t x) { return x | 0x5; }
-        static intptr_t tagintr(uintptr_t x) { return x | 0x7; }
-        static intptr_t tagvariant(uintptr_t x, variant_t variant) {
+        static constexpr void checkaligned(uintptr_t x) { assert((x & 0x7) == 0); }
+        static constexpr intptr_t tagsnok(uintptr_t x) { return x | 0x3; }
+        static constexpr intptr_t tagkons(uintptr_t x) { return x | 0x1; }
+        static constexpr intptr_t  tagval(uintptr_t x) { return x | 0x5; }
+        static constexpr intptr_t tagintr(uintptr_t x) { return x | 0x7; }
+        static constexpr intptr_t tagvariant(uintptr_t x, variant_t variant) {
             checkaligned(x);
             switch (variant) {
             case snokref: return tagsnok(x);
@@ -474,48 +1130,141 @@ namespace core {
             }
         }
     protected:
-        Ref(intptr_t w, variant_t variant);
+        constexpr Ref(intptr_t w, variant_t variant)
+            : Tagged(tagvariant(w, variant)) {}
 
         NO_NULL_CTOR(Ref);
     public:
-        Ref(Ref const &c) : Tagged(c) {}
+        constexpr Ref(Ref const &c) : Tagged(c) {}
     };
     typedef Ref ref_t;
 
     // A fixed-point-integer (fxi, fixint) is a 30-bit integer.
     class FixInt : public Atom {
     public:
-        static intptr_t tag(intptr_t x) { return x << 2 | 0x0; }
+        static constexpr intptr_t tag(intptr_t x) { return x << 2 | 0x0; }
     public:
-        FixInt(word_t w) : Atom(w) {}
-        FixInt(intptr_t x) : Atom(tag(x)) {}
+        constexpr FixInt(word_t w) : Atom(w) {}
+        constexpr FixInt(intptr_t x) : Atom(tag(x)) {}
         NO_NULL_CTOR(FixInt);
     public:
-        FixInt(FixInt const &x) : Atom(x) {}
+        constexpr FixInt(FixInt const &x) : Atom(x) {}
     };
 
     // A literal (lit) is a tagged constant.
     class Literal : public Atom {
     public:
-        explicit Literal(Content5 c) : Atom(c.tag(0x1a)) { }
+        constexpr explicit Literal(Content5 c) : Atom(c.tag(0x1a)) { }
 
         NO_NULL_CTOR(Literal);
     public:
-        Literal(Literal const &x) : Atom(x) {}
+        constexpr Literal(Literal const &x) : Atom(x) {}
     };
 
     namespace constants {
 #define DEFLITERAL(x, v)                                \
-        const Content5 Content ## x (v);               \
-        const Literal Literal ## x (Content ## x);
+        constexpr Content5 Content ## x (v);           \
+        constexpr Literal Literal ## x (Content ## x);
 
         DEFLITERAL(_true, 0x0);  // canonical truth, #t (for pure bool fcns)
         DEFLITERAL(_false, 0x1); // the false value, #f
         DEFLITERAL(_void, 0x2);  // the undisplayed value, #void
         DEFLITERAL(_null, 0x3);  // the empty list, #null
 #undef DEFLITERAL
+
+        // #t and #f differ in one bit, so is_bool is one mask and compare.
+        static_assert((Literal_true.uint() ^ Literal_false.uint()) == 0x20,
+                      "booleans differ solely in bit 5");
     };
 
+    // The type tests, inline so that each is a mask and compare on the
+    // word (the header tests then read one word more); see the table
+    // below Word::variant().
+
+    inline bool Tagged::is_fixint() const { return (this->val & 0x3) == 0; }
+
+    inline intptr_t Tagged::fixint_value() const {
+        assert(this->is_fixint());
+        return intptr_t(this->val) >> 2;
+    }
+
+    inline bool Tagged::is_bool() const {
+        return (this->val & ~uintptr_t(0x20)) == constants::Literal_true.uint();
+    }
+    inline bool Tagged::truth() const {
+        return this->val != constants::Literal_false.uint();
+    }
+    inline bool Tagged::is_null() const {
+        return this->val == constants::Literal_null.uint();
+    }
+    inline bool Tagged::is_void() const {
+        return this->val == constants::Literal_void.uint();
+    }
+
+    inline bool Tagged::is_kons() const { return (this->val & 0x7) == 0x1; }
+    inline bool Tagged::is_snok() const { return (this->val & 0x7) == 0x3; }
+    // konsref and snokref are the references x0x1.
+    inline bool Tagged::is_seq() const {
+        return (this->val & 0x5) == 0x1 || this->is_null();
+    }
+
+    inline bool Tagged::is_pair() const {
+        if ((this->val & 0x5) == 0x1)
+            return true;
+        if ((this->val & 0x7) != 0x5)
+            return false;
+        uintptr_t h = *(uintptr_t*)(this->val & ~0x7);
+        return Word::variant_of(h) == vechdr &&
+            Header::nym_code(h) == headers::pair.code();
+    }
+    inline bool Tagged::is_vec() const {
+        if ((this->val & 0x7) != 0x5)
+            return false;
+        return (*(uintptr_t*)(this->val & ~0x7) & 0xf) == 0x2;
+    }
+    // Records and nvecs are bvls too, but not for the bvl primops.
+    inline bool Tagged::is_bvl() const {
+        if ((this->val & 0x7) != 0x5)
+            return false;
+        uintptr_t h = *(uintptr_t*)(this->val & ~0x7);
+        return (h & 0xf) == 0xe && !Header::is_record(h) && !Header::is_nvec(h);
+    }
+    // A valref to a blob may point at its header or at its midder.
+    inline bool Tagged::is_blob() const {
+        if ((this->val & 0x7) != 0x5)
+            return false;
+        uintptr_t h = *(uintptr_t*)(this->val & ~0x7);
+        return (h & 0xf) == 0x6 || (h & 0x1f) == 0x0a;
+    }
+    inline bool Tagged::is_record() const {
+        if ((this->val & 0x7) != 0x5)
+            return false;
+        return Header::is_record(*(uintptr_t*)(this->val & ~0x7));
+    }
+    inline bool Tagged::is_nvec() const {
+        if ((this->val & 0x7) != 0x5)
+            return false;
+        return Header::is_nvec(*(uintptr_t*)(this->val & ~0x7));
+    }
+
+#define WRAPPED_PREDICATE(type_t, m)                                    \
+    inline type_t Handle::m() const { return this->value.m(); }         \
+    inline type_t Local::m() const { return this->value().m(); }
+
+    WRAPPED_PREDICATE(bool, is_seq);
+    WRAPPED_PREDICATE(bool, is_kons);
+    WRAPPED_PREDICATE(bool, is_snok);
+    WRAPPED_PREDICATE(bool, is_fixint);
+    WRAPPED_PREDICATE(bool, is_null);
+    WRAPPED_PREDICATE(intptr_t, fixint_value);
+    WRAPPED_PREDICATE(bool, is_pair);
+    WRAPPED_PREDICATE(bool, is_vec);
+    WRAPPED_PREDICATE(bool, is_bvl);
+    WRAPPED_PREDICATE(bool, is_blob);
+    WRAPPED_PREDICATE(bool, is_record);
+    WRAPPED_PREDICATE(bool, is_nvec);
+#undef WRAPPED_PREDICATE
+
     // The heap structure is a delicate topic.
     //
     // Here are some desiderata of interest to Felix:
@@ -601,6 +1350,11 @@ namespace core {
     // - a tagged ref-word, (low-order bit set to 1)
     // - a "tagged" raw-word, (low-order bit set to 0)
     // - an untagged word of meta-data (for the record or its block)
+    //
+    // As allocated (Space::make_record) it is a bvl of nym rcd, so that
+    // whatever does not know records takes it for raw bytes: the
+    // header, its length word (if any), the address of its Layout,
+    // then one slot per crumb of the layout.
     class Record : private WordSeq {
 
         NO_DEFAULT_CTORS(Record);
@@ -609,7 +1363,11 @@ namespace core {
 
 
     // A layout is a compact bitstring describing a sequence of words.
+    // Layouts live outside the heap, as native data; the collectors
+    // trace a record by its layout, so that unboxed native words sit
+    // beside the references without being mistaken for them.
     class Layout {
+    public:
         // Each word can be either:
         // - a tagged-value, i.e. ref or atom (tagged)
         // - an untagged uninterpreted datum  (nonptr)
@@ -620,33 +1378,44 @@ namespace core {
         // We call each two-bit entry a 'crumb', following a
         // less-than-universal (but semi-sane in analogy with 'bit',
         // 'nybble', and 'byte') convention
-
-        class Kind {
-            friend class Layout;
-            uint8_t val;
-            Kind(uint8_t v) : val(v) {}
-            static Kind tagged() { return Kind(0); }
-            static Kind nonptr() { return Kind(2); }
-            static Kind closep() { return Kind(1); }
-            static Kind farptr() { return Kind(3); }
-
-            NO_NULL_CTOR(Kind);
-        public: Kind(Kind const&x) : val(x.val) {}
-        };
+        //
+        // The low bit of a crumb marks an untagged pointer, the high bit
+        // a word that the record's own space does not trace; a closep
+        // holds the address of a header (as a valref would), or 0.
+        enum Kind { tagged = 0, closep = 1, nonptr = 2, farptr = 3 };
         typedef Kind kind_t;
 
-        static const kind_t tagged;
-        static const kind_t nonptr;
-        static const kind_t closep;
-        static const kind_t farptr;
+        // A layout of len crumbs, all tagged until set otherwise.
+        // Layouts are never freed (GUMP: there are few of them).
+        static Layout* make(size_t len);
 
-        size_t len; // length of the layout in crumbs (#entries)
-        // the allocated size for bits array will be rounded up to the
-        // word-boundary for this object.
-        int8_t bits[1];
-        kind_t describe(size_t i) {
-            return bits[i];
+        size_t length() const { return this->len; }
+        kind_t describe(size_t i) const {
+            assert(i < this->len);
+            return kind_t((this->crumbs[i >> 5] >> (2 * (i & 31))) & 0x3);
+        }
+        void set(size_t i, kind_t k) {
+            assert(i < this->len);
+            uint64_t &c = this->crumbs[i >> 5];
+            c = (c & ~(uint64_t(0x3) << (2 * (i & 31)))) | uint64_t(k) << (2 * (i & 31));
         }
+        // The crumbs of slots 32k to 32k + 31, slot 32k + i in bits 2i
+        // and 2i + 1.
+        uint64_t crumb_word(size_t k) const { return this->crumbs[k]; }
+
+        // The layout of the record at p, and its first slot.
+        static Layout const* of(const uintptr_t *p) {
+            return (Layout const*) p[Header::first_value(p)];
+        }
+        static uintptr_t* slots(uintptr_t *p) { return p + Header::first_value(p) + 1; }
+
+    private:
+        size_t len; // length of the layout in crumbs (#entries)
+        // the allocated size for crumbs array will be rounded up to
+        // whole words of 32 crumbs.
+        uint64_t crumbs[1];
+
+        NO_DEFAULT_CTORS(Layout);
     };
 
 
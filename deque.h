@@ -0,0 +1,121 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef DEQUE_H_INCLUDED
+#error "deque.h multiply included"
+#endif
+#define DEQUE_H_INCLUDED
+
+#include <atomic>
+
+namespace spaces {
+
+    // A Chase-Lev work-stealing deque (in the formulation of Le, Pop,
+    // Cohen and Zappa Nardelli, "Correct and Efficient Work-Stealing for
+    // Weak Memory Models").  Its owner pushes and pops at the bottom
+    // without contention; other threads steal from the top, and only
+    // race with the owner over the last element.
+    //
+    // The buffer doubles when full.  Outgrown buffers may still be read
+    // by a concurrent thief, so they are kept until the deque dies.
+    template <typename T>
+    class WorkDeque {
+    public:
+        WorkDeque() : top(0), bottom(0), array(new Array(64, 0)) {}
+        ~WorkDeque() {
+            Array *a = this->array.load(std::memory_order_relaxed);
+            while (a) {
+                Array *prev = a->prev;
+                delete a;
+                a = prev;
+            }
+        }
+
+        // Owner only.
+        void push(T x) {
+            intptr_t b = this->bottom.load(std::memory_order_relaxed);
+            intptr_t t = this->top.load(std::memory_order_acquire);
+            Array *a = this->array.load(std::memory_order_relaxed);
+            if (b - t > intptr_t(a->size) - 1)
+                a = this->grow(a, b, t);
+            a->put(b, x);
+            std::atomic_thread_fence(std::memory_order_release);
+            this->bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        // Owner only; false when empty.
+        bool pop(T *out) {
+            intptr_t b = this->bottom.load(std::memory_order_relaxed) - 1;
+            Array *a = this->array.load(std::memory_order_relaxed);
+            this->bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            intptr_t t = this->top.load(std::memory_order_relaxed);
+            if (t > b) {
+                this->bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+            T x = a->get(b);
+            if (t == b) {
+                // The last element: race any thief for it.
+                bool won = this->top.compare_exchange_strong(
+                    t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                this->bottom.store(b + 1, std::memory_order_relaxed);
+                if (!won)
+                    return false;
+            }
+            *out = x;
+            return true;
+        }
+
+        // Any thread; false when empty or when it lost a race.
+        bool steal(T *out) {
+            intptr_t t = this->top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            intptr_t b = this->bottom.load(std::memory_order_acquire);
+            if (t >= b)
+                return false;
+            Array *a = this->array.load(std::memory_order_acquire);
+            T x = a->get(t);
+            if (!this->top.compare_exchange_strong(
+                    t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return false;
+            *out = x;
+            return true;
+        }
+
+        // A hint only: may be stale by the time it returns.
+        bool looks_empty() const {
+            return this->bottom.load(std::memory_order_relaxed) <=
+                this->top.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Array {
+            Array(size_t size, Array *prev)
+                : size(size), prev(prev), slots(new std::atomic<T>[size]) {}
+            ~Array() { delete[] slots; }
+            T get(intptr_t i) {
+                return this->slots[i & (this->size - 1)].load(std::memory_order_relaxed);
+            }
+            void put(intptr_t i, T x) {
+                this->slots[i & (this->size - 1)].store(x, std::memory_order_relaxed);
+            }
+            size_t size; // a power of two
+            Array *prev;
+            std::atomic<T> *slots;
+        };
+
+        Array* grow(Array *a, intptr_t b, intptr_t t) {
+            Array *g = new Array(2 * a->size, a);
+            for (intptr_t i = t; i < b; i++)
+                g->put(i, a->get(i));
+            this->array.store(g, std::memory_order_release);
+            return g;
+        }
+
+        std::atomic<intptr_t> top;
+        std::atomic<intptr_t> bottom;
+        std::atomic<Array*> array;
+
+        NO_COPY_CTOR(WorkDeque);
+    };
+};
@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <cassert>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "spaces.h"
+#include "copying.h"
+#include "gen.h"
+
+namespace spaces {
+    const GenSpace::Frontier GenSpace::empty = { 0, 0, 0, 0, 0, 0 };
+
+    GenSpace::GenSpace()
+        : CopySpace(), old(empty), nursery_blocks(4), minor_count(0) {}
+
+    GenSpace::GenSpace(Policy const &p, size_t nursery_blocks)
+        : CopySpace(p), old(empty),
+          nursery_blocks(nursery_blocks), minor_count(0) {}
+
+    // The base class gives back the nursery; the old generation is
+    // parked apart from it.
+    GenSpace::~GenSpace() {
+        while (this->old.blocks) {
+            Block *b = this->old.blocks;
+            this->old.blocks = b->link;
+            Heap::give(b, b->units);
+        }
+    }
+
+    void GenSpace::park(Frontier &f) {
+        f.blocks = this->blocks;
+        f.last = this->last;
+        f.current = this->current;
+        f.cursor = this->cursor;
+        f.limit = this->limit;
+        f.count = this->block_count;
+        this->resume(empty);
+    }
+
+    void GenSpace::resume(Frontier const &f) {
+        this->blocks = f.blocks;
+        this->last = f.last;
+        this->current = f.current;
+        this->cursor = f.cursor;
+        this->limit = f.limit;
+        this->block_count = f.count;
+    }
+
+    // Large objects count with the old generation: minor collections
+    // never free them.
+    void* GenSpace::refill(core::formatted_t h, size_t n) {
+        if (this->collecting)
+            return BlockSpace::refill(h, n);
+        if (this->block_count >= this->nursery_blocks) {
+            this->collect_minor();
+            if (this->old.count + this->large_blocks() >= this->budget)
+                this->collect();
+            if (size_t(this->limit - this->cursor) >= n)
+                return this->bump(h, n);
+        } else if (n > this->policy.large_words() &&
+                   this->old.count + this->large_blocks() >= this->budget) {
+            this->collect();
+        }
+        return BlockSpace::refill(h, n);
+    }
+
+    // Evacuate the value slots of b that lie in its dirty cards (see
+    // visit_card).
+    void GenSpace::scan_cards(Block *b, Evacuator &ev) {
+        uintptr_t *start = (uintptr_t*) b->start();
+        uintptr_t *end = (uintptr_t*) this->fill(b);
+        if (start == end)
+            return;
+        size_t c1 = Heap::card_of(end - 1);
+        for (size_t c = Heap::card_of(start); c <= c1; c++) {
+            if (!core::Cards::table[c])
+                continue;
+            core::Cards::table[c] = 0;
+            visit_card(start, end, c, ev);
+        }
+    }
+
+    void GenSpace::collect_minor() {
+        this->retire();
+        for (Block *b = this->blocks; b; b = b->link)
+            b->flags |= Block::condemned;
+        Frontier young;
+        this->park(young);
+
+        // Promote into the old generation, carrying on from where its
+        // allocation left off.
+        Block *pinned = this->pin(&young.blocks);
+        this->resume(this->old);
+        this->resumed = this->current;
+        this->resumed_at = this->cursor;
+        Block *first = this->current ? this->current : this->last;
+        this->adopt(pinned);
+
+        this->collecting = true;
+        this->fresh_flags = Block::to_space;
+        Evacuator ev(this);
+        this->visit_roots(ev);
+        for (Block *b = this->blocks; b; b = b->link)
+            if (!(b->flags & Block::to_space))
+                this->scan_cards(b, ev);
+        for (Block *b = this->large.first(); b; b = b->link)
+            this->scan_cards(b, ev);
+        this->scan_blocks(first ? first : this->blocks);
+        Survivors sv(this);
+        this->sweep_weak(sv);
+        this->fresh_flags = 0;
+        this->collecting = false;
+        for (Block *b = first ? first : this->blocks; b; b = b->link)
+            b->flags &= ~(Block::to_space | Block::pinned);
+        this->resumed = 0;
+        this->resumed_at = 0;
+        this->park(this->old);
+
+        while (young.blocks) {
+            Block *b = young.blocks;
+            young.blocks = b->link;
+            Heap::give(b, b->units);
+        }
+        this->minor_count++;
+    }
+
+    void GenSpace::collect() {
+        // Fold the nursery into the old generation and copy the lot;
+        // the survivors make up the new old generation.
+        this->retire();
+        Frontier young;
+        this->park(young);
+        this->resume(this->old);
+        this->retire();
+        if (young.blocks) {
+            if (this->last)
+                this->last->link = young.blocks;
+            else
+                this->blocks = young.blocks;
+            this->last = young.last;
+            this->block_count += young.count;
+        }
+        CopySpace::collect();
+        this->park(this->old);
+    }
+}
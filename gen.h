@@ -0,0 +1,57 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef GEN_H_INCLUDED
+#error "gen.h multiply included"
+#endif
+#define GEN_H_INCLUDED
+
+#ifndef COPYING_H_INCLUDED
+#error "gen.h requires previous include: copying.h"
+#endif
+
+namespace spaces {
+
+    // A generational space.  Objects are born in a nursery of a few
+    // blocks; a minor collection promotes every nursery survivor into
+    // the old generation at once and frees the nursery.  Its roots are
+    // the handles plus the dirty cards of old blocks and of the large
+    // objects, which never move (see core::Cards), so its cost
+    // follows the survivors and the old slots written since
+    // the last collection, not the size of the old generation.  Once
+    // the old generation outgrows its budget, a major collection copies
+    // both generations just as CopySpace does.
+    class GenSpace : public CopySpace {
+    public:
+        GenSpace();
+        explicit GenSpace(Policy const &p, size_t nursery_blocks = 4);
+        ~GenSpace();
+
+        // A major collection.
+        virtual void collect();
+        void collect_minor();
+
+        size_t minor_collections() const { return this->minor_count; }
+        size_t old_blocks() const { return this->old.count; }
+
+    protected:
+        virtual void* refill(core::formatted_t h, size_t n);
+
+    private:
+        // The allocation state of the generation the space is not
+        // currently allocating into.
+        struct Frontier {
+            Block *blocks, *last, *current;
+            core::formatted_t *cursor, *limit;
+            size_t count;
+        };
+        void park(Frontier &f);
+        void resume(Frontier const &f);
+        void scan_cards(Block *b, Evacuator &ev);
+
+        static const Frontier empty;
+
+        Frontier old;
+        size_t nursery_blocks;
+        size_t minor_count;
+    };
+};
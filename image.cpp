@@ -0,0 +1,312 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <vector>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "spaces.h"
+#include "marksweep.h"
+#include "image.h"
+
+namespace spaces {
+    using core::Word;
+    using core::Header;
+    using core::Layout;
+
+    namespace {
+        const uint64_t magic = 0x01676d6963776868ull; // "hhwcimg", version 1
+
+        // The file starts with this, in the room its Block takes once
+        // loaded; then come the objects, the relocation table (the
+        // words holding references, then those holding a layout's
+        // index) and the entries of the heap's offset table.
+        struct FileHeader {
+            uint64_t magic;
+            uint64_t words;   // of objects
+            uint64_t relocs;
+            uint64_t layouts;
+            uint64_t cards;
+        };
+        static_assert(sizeof(FileHeader) <= sizeof(Block), "header must fit in a Block");
+
+        // Words before the first object, from the unit edge.
+        const size_t lead = sizeof(Block) / sizeof(uintptr_t);
+
+        bool put(int fd, const void *p, size_t bytes, off_t at) {
+            for (const char *c = (const char*) p; bytes; ) {
+                ssize_t k = pwrite(fd, c, bytes, at);
+                if (k <= 0)
+                    return false;
+                c += k, at += k, bytes -= k;
+            }
+            return true;
+        }
+
+        bool get(int fd, void *p, size_t bytes, off_t at) {
+            for (char *c = (char*) p; bytes; ) {
+                ssize_t k = pread(fd, c, bytes, at);
+                if (k <= 0)
+                    return false;
+                c += k, at += k, bytes -= k;
+            }
+            return true;
+        }
+
+        // Lays out the objects reachable from the roots, Cheney-style:
+        // the copies in words are themselves the queue still to scan.
+        class Writer {
+        public:
+            Writer(Layout const *const *layouts, size_t count)
+                : layouts(layouts), count(count), ok(true) {}
+
+            void run(core::handle_t const *roots, size_t n) {
+                this->words.push_back(Header::vec(core::headers::vec, n).uint());
+                if (n >= Header::vec_lmax)
+                    this->words.push_back(n << 2);
+                for (size_t i = 0; i < n; i++)
+                    this->words.push_back(roots[i].uint());
+                for (size_t i = 0; i < this->words.size(); )
+                    i += this->scan(i);
+            }
+
+            std::vector<uintptr_t> words;
+            std::vector<uint64_t> relocs, layout_relocs;
+            Layout const *const *layouts;
+            size_t count;
+            bool ok;
+
+        private:
+            // w as written: a reference becomes the byte offset of its
+            // target from the first object, with its tag.
+            uintptr_t place(uintptr_t w) {
+                uintptr_t *p = (uintptr_t*) (w & ~0x7), *o = p;
+                switch (Word::variant_of(w)) {
+                case Word::konsref:
+                    break;
+                case Word::valref:
+                    if (Word::variant_of(p[0]) == Word::blobmdr)
+                        o = p - Header::midder_delta(p[0]);
+                    break;
+                default:
+                    o = object_containing(p);
+                }
+                size_t at;
+                std::unordered_map<const uintptr_t*, size_t>::iterator f = this->placed.find(o);
+                if (f != this->placed.end()) {
+                    at = f->second;
+                } else {
+                    size_t n = 2;
+                    at = this->words.size();
+                    if (Header::is_header(o[0])) {
+                        n = Header::object_words(o);
+                        Word::variant_t v = Word::variant_of(o[0]);
+                        size_t raw = (lead + at + Header::first_raw(o)) * sizeof(uintptr_t);
+                        if ((v == Word::bvlhdr || v == Word::blobhdr) &&
+                            (raw & (Header::raw_align - 1))) {
+                            this->words.push_back(Header::filler());
+                            at++;
+                        }
+                    }
+                    this->words.insert(this->words.end(), o, o + n);
+                    this->placed[o] = at;
+                }
+                return (at + (p - o)) * sizeof(uintptr_t) | (w & 0x7);
+            }
+
+            void fix(size_t i) {
+                uintptr_t w = this->words[i];
+                if (!(w & 0x1)) // references are the odd tags
+                    return;
+                uintptr_t t = this->place(w);
+                this->words[i] = t;
+                this->relocs.push_back(i);
+            }
+
+            // Rewrite the references of the object at words[i]; returns
+            // its length.
+            size_t scan(size_t i) {
+                uintptr_t *p = &this->words[i];
+                if (!Header::is_header(p[0])) {
+                    this->fix(i);
+                    this->fix(i + 1);
+                    return 2;
+                }
+                size_t n = Header::object_words(p);
+                size_t a = i + Header::first_value(p);
+                if (Header::is_record(p[0])) {
+                    Layout const *l = Layout::of(p);
+                    size_t k = 0;
+                    while (k < this->count && this->layouts[k] != l)
+                        k++;
+                    this->ok = this->ok && k < this->count;
+                    this->words[a] = k;
+                    this->layout_relocs.push_back(a);
+                    for (size_t j = 0; j < l->length(); j++) {
+                        size_t s = a + 1 + j;
+                        switch (l->describe(j)) {
+                        case Layout::tagged:
+                            this->fix(s);
+                            break;
+                        case Layout::closep:
+                            if (this->words[s]) {
+                                uintptr_t t = this->place(this->words[s] | 0x5) & ~uintptr_t(0x7);
+                                this->words[s] = t;
+                                this->relocs.push_back(s);
+                            }
+                            break;
+                        default:
+                            break;
+                        }
+                    }
+                    return n;
+                }
+                size_t z = a + Header::value_words(p);
+                for (size_t j = a; j < z; j++)
+                    this->fix(j);
+                return n;
+            }
+
+            std::unordered_map<const uintptr_t*, size_t> placed;
+        };
+
+        // Give back the run under an image, mapped anonymous again so
+        // that the heap can hand it out zero-filled.
+        void drop(Block *b) {
+            size_t units = b->units;
+            void *m = mmap(b, units << Heap::unit_shift, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+            assert(m == (void*) b);
+            Heap::give(b, units);
+        }
+    }
+
+    status::status_t Image::write(int fd, core::handle_t const *roots, size_t n,
+                                  Layout const *const *layouts, size_t layout_count) {
+        Writer w(layouts, layout_count);
+        w.run(roots, n);
+        if (!w.ok) // a record whose layout is not in the table
+            return status::Status::failure();
+
+        FileHeader fh;
+        memset(&fh, 0, sizeof(fh));
+        fh.magic = magic;
+        fh.words = w.words.size();
+        fh.relocs = w.relocs.size();
+        fh.layouts = w.layout_relocs.size();
+        fh.cards = (lead + fh.words + Heap::card_words - 1) / Heap::card_words;
+        std::vector<uint8_t> entries(fh.cards);
+        for (size_t i = 0; i < fh.words; ) {
+            uintptr_t *p = &w.words[i];
+            size_t k = Header::is_header(p[0]) ? Header::object_words(p) : 2;
+            Heap::note_object(entries.data(), lead + i, k);
+            i += k;
+        }
+
+        off_t at = 0;
+        bool ok = put(fd, &fh, sizeof(fh), at);
+        at = lead * sizeof(uintptr_t);
+        ok = ok && put(fd, w.words.data(), fh.words * sizeof(uintptr_t), at);
+        at += fh.words * sizeof(uintptr_t);
+        ok = ok && put(fd, w.relocs.data(), fh.relocs * sizeof(uint64_t), at);
+        at += fh.relocs * sizeof(uint64_t);
+        ok = ok && put(fd, w.layout_relocs.data(), fh.layouts * sizeof(uint64_t), at);
+        at += fh.layouts * sizeof(uint64_t);
+        ok = ok && put(fd, entries.data(), fh.cards, at);
+        ok = ok && ftruncate(fd, at + fh.cards) == 0;
+        return ok ? status::Status::success() : status::Status::failure();
+    }
+
+    Image::Image(core::Space &s) : space(&s), anchor(s.null()), block(0) {}
+
+    Image::~Image() {
+        if (this->block == 0)
+            return;
+        this->space->remove_region(this);
+        drop(this->block);
+    }
+
+    status::status_t Image::load(int fd, Layout const *const *layouts, size_t layout_count) {
+        assert(this->block == 0);
+        FileHeader fh;
+        struct stat st;
+        if (!get(fd, &fh, sizeof(fh), 0) || fh.magic != magic || fstat(fd, &st) != 0)
+            return status::Status::failure();
+        size_t objects = (lead + fh.words) * sizeof(uintptr_t);
+        size_t relocs = fh.relocs + fh.layouts;
+        if (uint64_t(st.st_size) != objects + relocs * sizeof(uint64_t) + fh.cards ||
+            fh.cards != (lead + fh.words + Heap::card_words - 1) / Heap::card_words)
+            return status::Status::failure();
+        std::vector<uint64_t> table(relocs);
+        std::vector<uint8_t> entries(fh.cards);
+        if (!get(fd, table.data(), relocs * sizeof(uint64_t), objects) ||
+            !get(fd, entries.data(), fh.cards, objects + relocs * sizeof(uint64_t)))
+            return status::Status::failure();
+
+        size_t units = Block::units_for(fh.words);
+        void *m = Heap::take(units);
+        if (m == 0)
+            return status::Status::failure();
+        if (mmap(m, objects, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            Heap::give(m, units);
+            return status::Status::failure();
+        }
+        Block *b = new (m) Block(0, units);
+        b->cursor = b->scan = b->start() + fh.words;
+
+        uintptr_t *o = (uintptr_t*) b->start();
+        bool ok = fh.words > 0 && Word::variant_of(o[0]) == Word::vechdr;
+        for (size_t i = 0; ok && i < fh.relocs; i++) {
+            ok = table[i] < fh.words;
+            if (ok)
+                o[table[i]] += uintptr_t(o);
+        }
+        for (size_t i = fh.relocs; ok && i < relocs; i++) {
+            ok = table[i] < fh.words && o[table[i]] < layout_count;
+            if (ok)
+                o[table[i]] = uintptr_t(layouts[o[table[i]]]);
+        }
+        if (!ok) {
+            drop(b);
+            return status::Status::failure();
+        }
+        Heap::load_offsets(m, entries.data(), fh.cards);
+        this->block = b;
+        this->space->add_region(this);
+        return status::Status::success();
+    }
+
+    size_t Image::roots() const {
+        return this->block ? Header::value_words((uintptr_t*) this->block->start()) : 0;
+    }
+
+    core::handle_t Image::root(size_t i) const {
+        assert(i < this->roots());
+        uintptr_t *o = (uintptr_t*) this->block->start();
+        return core::handle_t(this->anchor, ((core::tagged_t*) (o + Header::first_value(o)))[i]);
+    }
+
+    size_t Image::words() const {
+        return this->block ? this->block->cursor - this->block->start() : 0;
+    }
+
+    // The image is scanned by no collection, so a dirty card of it stays
+    // dirty: what it refers to in the space must be seen by each one.
+    void Image::visit_refs(core::RootVisitor &v) {
+        uintptr_t *start = (uintptr_t*) this->block->start();
+        uintptr_t *end = (uintptr_t*) this->block->cursor;
+        size_t c1 = Heap::card_of(end - 1);
+        for (size_t c = Heap::card_of(start); c <= c1; c++)
+            if (core::Cards::table[c])
+                visit_card(start, end, c, v);
+    }
+}
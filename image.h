@@ -0,0 +1,63 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef IMAGE_H_INCLUDED
+#error "image.h multiply included"
+#endif
+#define IMAGE_H_INCLUDED
+
+#ifndef SPACES_H_INCLUDED
+#error "image.h requires previous include: spaces.h"
+#endif
+
+namespace spaces {
+
+    // A heap image is the graph of objects reachable from some roots,
+    // written to a file so that a later process can map it in instead
+    // of building it again.  In the file the objects lie as they will
+    // in the heap, behind a header the size of a Block, the first of
+    // them a vec of the roots; each reference is held as its offset
+    // from that first object, and a relocation table lists the words
+    // that hold one.  A record's layout is written as its index in a
+    // table of layouts, which loading must be given again.  Far
+    // pointers in records are written as they are.
+    //
+    // Loading maps the file copy-on-write over a run of heap units and
+    // adds the address of the first object to each word in the table,
+    // so the pages read are those holding references, and those used
+    // later; raw bytes and atoms stay on disk until touched.  The image
+    // is then a block of no space's: no collection moves or frees its
+    // objects.  It is a root region of the space it is loaded into (the
+    // references in its dirty cards are roots), so that its objects may
+    // be stored into as those of any old block may.  They last as long
+    // as the Image does.
+    class Image : public core::RootRegion {
+    public:
+        explicit Image(core::Space &s);
+        ~Image();
+
+        // Write the objects reachable from roots[0, n) to fd, as an
+        // image at its start, replacing whatever it held.
+        static status::status_t write(int fd, core::handle_t const *roots, size_t n,
+                                      core::Layout const *const *layouts = 0,
+                                      size_t layout_count = 0);
+
+        // Map in the image that fd holds (from its start), at most one
+        // per Image; fails, leaving this empty, if fd holds none.
+        status::status_t load(int fd, core::Layout const *const *layouts = 0,
+                              size_t layout_count = 0);
+
+        size_t roots() const;
+        core::handle_t root(size_t i) const;
+        // Words of objects in the image, 0 until loaded.
+        size_t words() const;
+
+        virtual void visit_refs(core::RootVisitor &v);
+
+    private:
+        core::Space *space;
+        core::handle_t anchor; // a handle of the space, to link roots to
+        Block *block;          // holds the objects, once loaded
+
+        NO_COPY_CTOR(Image);
+    };
+};
@@ -0,0 +1,185 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "intern.h"
+
+namespace core {
+
+    namespace {
+        uint64_t mix(uint64_t k, uint64_t x) {
+            k = (k ^ x) * 0x9e3779b97f4a7c15ull;
+            return k ^ (k >> 29);
+        }
+
+        // The contents of w, an interned pair or vec.
+        nym_t contents(uintptr_t w, const uintptr_t **words, size_t *n) {
+            uintptr_t *p = (uintptr_t*) (w & ~0x7);
+            if (Word::variant_of(w) == Word::konsref) {
+                *words = p;
+                *n = 2;
+                return headers::cons;
+            }
+            *words = p + Header::first_value(p);
+            *n = Header::value_words(p);
+            return nym_t::of_code(Header::nym_code(p[0]));
+        }
+
+        // A hit may hand an object that the marker has yet to reach to
+        // a field it has already traced: shade it, as the barrier would.
+        uintptr_t found(uintptr_t w) {
+            if (Satb::active)
+                Satb::log(w);
+            return w;
+        }
+    }
+
+    Interns::Interns(Space &s) : space(&s) {
+        assert(s.interns == 0); // GUMP: one table per space
+        s.interns = this;
+    }
+
+    Interns::~Interns() { this->space->interns = 0; }
+
+    size_t Interns::size() {
+        size_t n = 0;
+        for (size_t i = 0; i < stripe_count; i++) {
+            std::lock_guard<std::mutex> l(this->stripes[i].lock);
+            n += this->stripes[i].used;
+        }
+        return n;
+    }
+
+    uint64_t Interns::hash(nym_t h, const uintptr_t *words, size_t n) {
+        uint64_t k = mix(h.code(), n);
+        for (size_t i = 0; i < n; i++)
+            k = mix(k, words[i]);
+        return k;
+    }
+
+    uint64_t Interns::hash_of(uintptr_t w) {
+        const uintptr_t *words;
+        size_t n;
+        nym_t h = contents(w, &words, &n);
+        return hash(h, words, n);
+    }
+
+    bool Interns::holds(uintptr_t w, nym_t h, const uintptr_t *words, size_t n) {
+        const uintptr_t *v;
+        size_t m;
+        if (contents(w, &v, &m).code() != h.code() || m != n)
+            return false;
+        return memcmp(v, words, n * sizeof(uintptr_t)) == 0;
+    }
+
+    // The stripe is the top bits of the hash, the first slot tried the
+    // bottom ones.
+    void Interns::put(Stripe &s, uint64_t k, uintptr_t w) {
+        size_t mask = s.slots.size() - 1, i = k & mask;
+        while (s.slots[i])
+            i = (i + 1) & mask;
+        s.slots[i] = w;
+        s.used++;
+    }
+
+    void Interns::grow(Stripe &s) {
+        std::vector<uintptr_t> old;
+        old.swap(s.slots);
+        s.slots.assign(old.empty() ? 16 : 2 * old.size(), 0);
+        s.used = 0;
+        for (size_t i = 0; i < old.size(); i++)
+            if (old[i])
+                put(s, hash_of(old[i]), old[i]);
+    }
+
+    uintptr_t Interns::find(nym_t h, const uintptr_t *words, size_t n) {
+        uint64_t k = hash(h, words, n);
+        Stripe &s = this->stripes[k >> 58];
+        std::lock_guard<std::mutex> l(s.lock);
+        if (s.slots.empty())
+            return 0;
+        size_t mask = s.slots.size() - 1;
+        for (size_t i = k & mask; s.slots[i]; i = (i + 1) & mask)
+            if (holds(s.slots[i], h, words, n))
+                return found(s.slots[i]);
+        return 0;
+    }
+
+    // Objects move only in collections, which wait for the lock to go.
+    uintptr_t Interns::insert(uintptr_t w) {
+        const uintptr_t *words;
+        size_t n;
+        nym_t h = contents(w, &words, &n);
+        uint64_t k = hash(h, words, n);
+        Stripe &s = this->stripes[k >> 58];
+        std::lock_guard<std::mutex> l(s.lock);
+        if (!s.slots.empty()) {
+            size_t mask = s.slots.size() - 1;
+            for (size_t i = k & mask; s.slots[i]; i = (i + 1) & mask)
+                if (holds(s.slots[i], h, words, n))
+                    return found(s.slots[i]);
+        }
+        if (2 * (s.used + 1) > s.slots.size())
+            grow(s);
+        put(s, k, w);
+        return w;
+    }
+
+    // Every stripe is rebuilt from the survivors, at a size to fit.
+    // The collection has stopped every other thread of the space.
+    void Interns::sweep(WeakVisitor &v) {
+        std::vector<uintptr_t> live;
+        for (size_t i = 0; i < stripe_count; i++) {
+            Stripe &s = this->stripes[i];
+            for (size_t j = 0; j < s.slots.size(); j++)
+                if (s.slots[j])
+                    if (uintptr_t w = v.survivor(s.slots[j]))
+                        live.push_back(w);
+            s.used = 0;
+        }
+        std::vector<uint64_t> keys(live.size());
+        size_t counts[stripe_count] = { 0 };
+        for (size_t i = 0; i < live.size(); i++) {
+            keys[i] = hash_of(live[i]);
+            counts[keys[i] >> 58]++;
+        }
+        for (size_t i = 0; i < stripe_count; i++) {
+            size_t size = 16;
+            while (size < 2 * counts[i])
+                size *= 2;
+            this->stripes[i].slots.assign(counts[i] ? size : 0, 0);
+        }
+        for (size_t i = 0; i < live.size(); i++)
+            put(this->stripes[keys[i] >> 58], keys[i], live[i]);
+    }
+
+    template <typename A, typename D>
+    handle_t Space::intern_pair(A const& ar, D const& dr) {
+        Interns *t = this->intern_table();
+        assert(t != 0); // GUMP: hash-consing wants an Interns on the space
+        uintptr_t words[2] = { value_of(ar).uint(), value_of(dr).uint() };
+        nym_t h = value_of(dr).is_seq() ? headers::cons : headers::pair;
+        uintptr_t w = t->find(h, words, 2);
+        if (w)
+            return Handle(this->roots, *(tagged_t*) &w);
+        return this->intern(this->cons(ar, dr));
+    }
+
+    handle_t Space::hcons(handle_t ar, handle_t dr) { return intern_pair(ar, dr); }
+    handle_t Space::hcons(atom_t ar, handle_t dr) { return intern_pair(ar, dr); }
+    handle_t Space::hcons(handle_t ar, atom_t dr) { return intern_pair(ar, dr); }
+    handle_t Space::hcons(atom_t ar, atom_t dr) { return intern_pair(ar, dr); }
+
+    handle_t Space::intern(handle_t const& v) {
+        Interns *t = this->intern_table();
+        assert(t != 0); // GUMP: as above
+        uintptr_t w = t->insert(v.uint());
+        return w == v.uint() ? v : Handle(this->roots, *(tagged_t*) &w);
+    }
+}
@@ -0,0 +1,73 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef INTERN_H_INCLUDED
+#error "intern.h multiply included"
+#endif
+#define INTERN_H_INCLUDED
+
+#ifndef CORE_H_INCLUDED
+#error "intern.h requires previous include: core.h"
+#endif
+
+#include <mutex>
+#include <vector>
+
+namespace core {
+
+    // A space's table of interned objects, for hash-consing (see
+    // Space::hcons, make_ivec): immutable pairs and vecs, at most one
+    // for each content, where the content is the words of the object
+    // (and the nym of a vec).  So two interned objects built alike from
+    // atoms and interned objects are one object, and equal exactly when
+    // their references are.  An interned object must never be stored
+    // into.
+    //
+    // The table holds its objects weakly: it is no root, and each
+    // collection of the space drops the entries whose objects died,
+    // and rehashes the rest, which may have moved (see
+    // Space::sweep_weak).  Rehashing goes over the whole table, so it
+    // adds to every collection, minor ones too, a cost that follows
+    // the number of entries.
+    //
+    // Lookups may run on several threads at once: the table is split
+    // into stripes by hash, each an open-addressed table under a lock
+    // of its own.  No lock is held while allocating, so a thread that
+    // waits on one is never waiting on a stopped thread.  Make it on a
+    // SharedSpace to intern through that space's mutators.
+    class Interns {
+    public:
+        explicit Interns(Space &s);
+        ~Interns();
+
+        // Entries, live or not yet found dead.
+        size_t size();
+
+        // The interned object with these contents, or 0: a vec of nym h
+        // and the n words, or for h cons, a kons cell of the 2.
+        uintptr_t find(nym_t h, const uintptr_t *words, size_t n);
+        // Intern w, a fresh pair or vec, unless one with its contents
+        // came first; returns the one interned.
+        uintptr_t insert(uintptr_t w);
+        void sweep(WeakVisitor &v);
+
+    private:
+        static const size_t stripe_count = 64;
+        struct Stripe {
+            std::mutex lock;
+            std::vector<uintptr_t> slots; // 0, or an interned object
+            size_t used;
+            Stripe() : used(0) {}
+        };
+        static uint64_t hash_of(uintptr_t w);
+        static uint64_t hash(nym_t h, const uintptr_t *words, size_t n);
+        static bool holds(uintptr_t w, nym_t h, const uintptr_t *words, size_t n);
+        // requires: the stripe's lock, and room.
+        static void put(Stripe &s, uint64_t k, uintptr_t w);
+        static void grow(Stripe &s);
+
+        Space *space;
+        Stripe stripes[stripe_count];
+
+        NO_COPY_CTOR(Interns);
+    };
+};
@@ -0,0 +1,370 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+#include <chrono>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "spaces.h"
+#include "marksweep.h"
+#include "wordscan.h"
+
+namespace spaces {
+    using core::Header;
+
+    static double now_ms() {
+        using namespace std::chrono;
+        return duration<double, std::milli>(
+            steady_clock::now().time_since_epoch()).count();
+    }
+
+    uintptr_t* object_containing(uintptr_t *p) {
+        assert(Heap::contains(p)); // GUMP: heap objects only
+        Block *b = Block::of(p);
+        if (b->flags & Block::cells) {
+            Page *pg = (Page*) b;
+            uintptr_t *q = pg->cell(pg->index_of(p));
+            return q[0] == Header::filler() ? q + 1 : q;
+        }
+        return object_start(p, [](uintptr_t *s) {
+            return Header::is_header(s[0]) ? Header::object_words(s) : size_t(2);
+        });
+    }
+
+    const size_t MarkSweepSpace::class_words[class_count] = {
+        2, 4, 6, 8, 10, 12, 16, 20, 24, 32, 40,
+        48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512
+    };
+
+    Page::Page(core::Space *owner, size_t units, size_t cell_words)
+        : Block(owner, units), next(0), cell_words(cell_words) {
+        this->flags = Block::cells;
+        // Fit as many cells as possible, with one mark bit apiece.
+        size_t words = ((units << Heap::unit_shift) - sizeof(Page)) / sizeof(uintptr_t) - 1;
+        this->cells = words * 64 / (64 * cell_words + 1);
+        this->marks = (uintptr_t*) (this + 1);
+        this->first = this->marks + ((this->cells + 63) >> 6);
+        this->cursor = (core::formatted_t*) this->cell(this->cells);
+    }
+
+    MarkSweepSpace::MarkSweepSpace()
+        : live_words(0), policy(), page_count(0),
+          budget(policy.heap_blocks()), gc_count(0), mark_threads(1),
+          slice_ms(0), slice_period(1024), since_slice(0), marking_now(false),
+          slice_count(0), max_pause_ms(0) {
+        for (size_t c = 0; c <= class_count; c++) {
+            this->classes[c].pages = 0;
+            this->classes[c].unswept = &this->classes[c].pages;
+            this->classes[c].free = 0;
+        }
+    }
+
+    MarkSweepSpace::MarkSweepSpace(Policy const &p)
+        : live_words(0), policy(p), page_count(0),
+          budget(p.heap_blocks()), gc_count(0), mark_threads(1),
+          slice_ms(0), slice_period(1024), since_slice(0), marking_now(false),
+          slice_count(0), max_pause_ms(0) {
+        for (size_t c = 0; c <= class_count; c++) {
+            this->classes[c].pages = 0;
+            this->classes[c].unswept = &this->classes[c].pages;
+            this->classes[c].free = 0;
+        }
+    }
+
+    MarkSweepSpace::~MarkSweepSpace() {
+        if (this->marking_now) {
+            core::Satb::active = false;
+            while (!core::Satb::empty())
+                core::Satb::pop();
+        }
+        for (size_t c = 0; c <= class_count; c++) {
+            while (this->classes[c].pages) {
+                Page *pg = this->classes[c].pages;
+                this->classes[c].pages = pg->next;
+                Heap::give(pg, pg->units);
+            }
+        }
+    }
+
+    size_t MarkSweepSpace::class_of(size_t words) {
+        for (size_t c = 0; c < class_count; c++)
+            if (words <= class_words[c])
+                return c;
+        return class_count;
+    }
+
+    Page* MarkSweepSpace::new_page(size_t c, size_t words) {
+        size_t units = Block::units_for(this->policy.block_words());
+        if (c == class_count) {
+            size_t bytes = sizeof(Page) + (words + 2) * sizeof(uintptr_t);
+            units = (bytes + Heap::unit_bytes - 1) >> Heap::unit_shift;
+        }
+        void *m = Heap::take(units);
+        assert(m != 0); // GUMP: assume the heap suffices
+        Page *pg = new (m) Page(this, units, words);
+        this->page_count++;
+
+        Class &k = this->classes[c];
+        if (c == class_count) {
+            pg->cells = 1;
+            pg->next = k.pages;
+            k.pages = pg;
+            return pg;
+        }
+        // Link it in just ahead of the pages still to be swept: its
+        // objects carry no marks, so it must not be swept this cycle.
+        pg->next = *k.unswept;
+        *k.unswept = pg;
+        k.unswept = &pg->next;
+        for (size_t i = pg->cells; i-- > 0; ) {
+            Free *f = (Free*) pg->cell(i);
+            f->next = k.free;
+            k.free = f;
+        }
+        return pg;
+    }
+
+    void MarkSweepSpace::sweep(Class &k) {
+        Page *pg = *k.unswept;
+        size_t live = 0;
+        for (size_t i = 0; i < pg->cells; i++)
+            live += pg->marked(i);
+        if (live == 0) {
+            *k.unswept = pg->next;
+            this->page_count--;
+            Heap::give(pg, pg->units);
+            return;
+        }
+        for (size_t i = pg->cells; i-- > 0; ) {
+            if (pg->marked(i))
+                continue;
+            Free *f = (Free*) pg->cell(i);
+            f->next = k.free;
+            k.free = f;
+        }
+        k.unswept = &pg->next;
+    }
+
+    void MarkSweepSpace::sweep_large() {
+        Class &k = this->classes[class_count];
+        for (Page **l = &k.pages; *l; ) {
+            Page *pg = *l;
+            if (pg->marked(0)) {
+                l = &pg->next;
+                continue;
+            }
+            *l = pg->next;
+            this->page_count--;
+            Heap::give(pg, pg->units);
+        }
+    }
+
+    void* MarkSweepSpace::refill(core::formatted_t h, size_t n) {
+        if (this->marking_now && ++this->since_slice >= this->slice_period) {
+            this->since_slice = 0;
+            this->mark_slice();
+        }
+        size_t c = class_of(n);
+        bool collected = false;
+        if (c == class_count) {
+            if (!this->marking_now && this->page_count >= this->budget)
+                this->over_budget();
+            core::formatted_t *m = (core::formatted_t*) this->new_page(c, n)->first;
+            this->shade_new(m);
+            m[0] = h;
+            return m;
+        }
+        // While marking, the marks on unswept pages are not final, so
+        // they must wait; allocation takes fresh pages instead.
+        Class &k = this->classes[c];
+        while (k.free == 0) {
+            if (!this->marking_now && *k.unswept) {
+                this->sweep(k);
+            } else if (!collected && !this->marking_now &&
+                       this->page_count >= this->budget) {
+                this->over_budget();
+                collected = true;
+            } else {
+                this->new_page(c, class_words[c]);
+            }
+        }
+        Free *f = k.free;
+        k.free = f->next;
+        core::formatted_t *m = (core::formatted_t*) f;
+        this->shade_new(m);
+        m[0] = h;
+        return m;
+    }
+
+    void MarkSweepSpace::over_budget() {
+        if (this->slice_ms > 0)
+            this->start_marking();
+        else
+            this->collect();
+    }
+
+    // Objects allocated while marking are born marked: they were not
+    // in the snapshot, and their fields only hold values the mutator
+    // got from it (or from other new objects).
+    void MarkSweepSpace::shade_new(void *cell) {
+        if (!this->marking_now)
+            return;
+        Page *pg = Page::of(cell);
+        pg->mark(pg->index_of(cell));
+        this->live_words += pg->cell_words;
+    }
+
+    void MarkSweepSpace::mark_word(uintptr_t w) {
+        if (!(w & 0x1)) // references are the odd tags
+            return;
+        uintptr_t *p = (uintptr_t*) (w & ~0x7);
+        if (!Heap::contains(p))
+            return;
+        Page *pg = Page::of(p);
+        if (pg == 0 || pg->owner != this || !pg->holds(p))
+            return;
+        size_t i = pg->index_of(p);
+        if (pg->mark(i)) {
+            this->live_words += pg->cell_words;
+            this->stack.push(pg->cell(i));
+        }
+    }
+
+    void MarkSweepSpace::trace_cell(uintptr_t *p) {
+        if (p[0] == Header::filler()) // raw bytes aligned: the object follows
+            p++;
+        if (!Header::is_header(p[0])) {
+            this->mark_word(p[0]);
+            this->mark_word(p[1]);
+            return;
+        }
+        if (Header::is_record(p[0])) {
+            core::Layout const *l = core::Layout::of(p);
+            core::each_record_ref(core::Layout::slots(p), l, 0, l->length(),
+                                  [this](uintptr_t *slot, bool untagged) {
+                this->mark_word(untagged ? *slot | 0x5 : *slot);
+            });
+            return;
+        }
+        size_t i = Header::first_value(p);
+        core::each_ref(p + i, Header::value_words(p),
+                       [this](uintptr_t *slot) { this->mark_word(*slot); });
+    }
+
+    void MarkSweepSpace::drain() {
+        while (!this->stack.empty())
+            this->trace_cell(this->stack.pop());
+    }
+
+    void MarkSweepSpace::note_pause(double ms) {
+        if (ms > this->max_pause_ms)
+            this->max_pause_ms = ms;
+    }
+
+    // Unswept pages still hold the last cycle's marks; start over.
+    void MarkSweepSpace::begin_cycle() {
+        for (size_t c = 0; c <= class_count; c++)
+            for (Page *pg = this->classes[c].pages; pg; pg = pg->next)
+                pg->clear_marks();
+        this->live_words = 0;
+    }
+
+    uintptr_t MarkSweepSpace::Survivors::survivor(uintptr_t w) {
+        uintptr_t *p = (uintptr_t*) (w & ~0x7);
+        if (!Heap::contains(p))
+            return w;
+        Page *pg = Page::of(p);
+        if (pg == 0 || pg->owner != this->space || !pg->holds(p))
+            return w;
+        return pg->marked(pg->index_of(p)) ? w : 0;
+    }
+
+    void MarkSweepSpace::end_cycle() {
+        // Before the sweep, which may hand dead cells out again.
+        Survivors sv(this);
+        this->sweep_weak(sv);
+        // The free lists hold only cells the sweep will find free again
+        // (allocated ones are marked); drop them, and sweep everything.
+        for (size_t c = 0; c <= class_count; c++)
+            this->classes[c].free = 0;
+        for (size_t c = 0; c < class_count; c++)
+            this->classes[c].unswept = &this->classes[c].pages;
+        this->sweep_large();
+        this->gc_count++;
+
+        // Keep at least as much headroom as there are survivors.
+        size_t page_words = (Block::units_for(this->policy.block_words())
+                             << Heap::unit_shift) / sizeof(uintptr_t);
+        size_t live_pages = this->live_words / page_words + 1;
+        if (2 * live_pages > this->budget)
+            this->budget = 2 * live_pages;
+    }
+
+    void MarkSweepSpace::start_marking() {
+        double t0 = now_ms();
+        assert(!core::Satb::active); // one incremental marker at a time
+        this->begin_cycle();
+        Marker m(this);
+        this->visit_roots(m);
+        AmbiguousMarker am(this);
+        this->visit_stack(am);
+        core::Satb::active = true;
+        this->marking_now = true;
+        this->since_slice = 0;
+        this->note_pause(now_ms() - t0);
+    }
+
+    // Trace for at most slice_ms, and finish the cycle if nothing is
+    // left: no grey objects, and nothing logged by the barrier.
+    void MarkSweepSpace::mark_slice() {
+        double t0 = now_ms();
+        for (size_t n = 1; ; n++) {
+            if (this->stack.empty()) {
+                if (core::Satb::empty()) {
+                    core::Satb::active = false;
+                    this->marking_now = false;
+                    this->end_cycle();
+                    break;
+                }
+                while (!core::Satb::empty())
+                    this->mark_word(core::Satb::pop());
+                continue;
+            }
+            this->trace_cell(this->stack.pop());
+            if (n % 64 == 0 && now_ms() - t0 >= this->slice_ms)
+                break;
+        }
+        this->slice_count++;
+        this->note_pause(now_ms() - t0);
+    }
+
+    void MarkSweepSpace::collect() {
+        double t0 = now_ms();
+        if (this->marking_now) {
+            core::Satb::active = false;
+            this->marking_now = false;
+            do {
+                while (!core::Satb::empty())
+                    this->mark_word(core::Satb::pop());
+                this->drain();
+            } while (!core::Satb::empty());
+        } else {
+            this->begin_cycle();
+            if (this->mark_threads > 1) {
+                this->mark_parallel();
+            } else {
+                Marker m(this);
+                this->visit_roots(m);
+                AmbiguousMarker am(this);
+                this->visit_stack(am);
+                this->drain();
+            }
+        }
+        this->end_cycle();
+        this->note_pause(now_ms() - t0);
+    }
+}
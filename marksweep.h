@@ -0,0 +1,215 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef MARKSWEEP_H_INCLUDED
+#error "marksweep.h multiply included"
+#endif
+#define MARKSWEEP_H_INCLUDED
+
+#ifndef SPACES_H_INCLUDED
+#error "marksweep.h requires previous include: spaces.h"
+#endif
+
+#include <string.h>
+
+namespace spaces {
+
+    // A growable stack of objects whose fields remain to be traced.
+    class MarkStack {
+    public:
+        MarkStack() : base(0), top(0), cap(0) {}
+        ~MarkStack() { free(this->base); }
+
+        bool empty() const { return this->top == 0; }
+        size_t size() const { return this->top; }
+        void push(uintptr_t *p) {
+            if (this->top == this->cap)
+                this->grow();
+            this->base[this->top++] = p;
+        }
+        uintptr_t* pop() { return this->base[--this->top]; }
+
+    private:
+        void grow() {
+            this->cap = this->cap ? 2 * this->cap : 1024;
+            this->base = (uintptr_t**) realloc(this->base, this->cap * sizeof(uintptr_t*));
+            assert(this->base != 0); // GUMP: assume mallocs don't fail
+        }
+        uintptr_t **base;
+        size_t top, cap;
+
+        NO_COPY_CTOR(MarkStack);
+    };
+
+    // A page of a mark-sweep space: a block carved into equal cells of
+    // one size class.  The mark bits live in a bitmap beside the cells
+    // (one bit per cell), not in the objects, since a header-less pair
+    // has no room for one; a cell is found from any address inside it
+    // by division, so interior references cost nothing extra.
+    class Page : public Block {
+    public:
+        Page(core::Space *owner, size_t units, size_t cell_words);
+
+        static Page* of(const void *p) { return (Page*) Block::of(p); }
+
+        uintptr_t* cell(size_t i) { return this->first + i * this->cell_words; }
+        // requires: p lies within the cells of this page.
+        size_t index_of(const void *p) {
+            return ((uintptr_t*) p - this->first) / this->cell_words;
+        }
+        bool holds(const void *p) {
+            return this->first <= (uintptr_t*) p &&
+                (uintptr_t*) p < this->cell(this->cells);
+        }
+
+        bool marked(size_t i) { return (this->marks[i >> 6] >> (i & 63)) & 1; }
+        // Sets the mark; false if it was already set.
+        bool mark(size_t i) {
+            uintptr_t bit = uintptr_t(1) << (i & 63);
+            if (this->marks[i >> 6] & bit)
+                return false;
+            this->marks[i >> 6] |= bit;
+            return true;
+        }
+        // As mark, but safe against other marking threads: exactly one
+        // of several racing callers sees true.
+        bool mark_atomic(size_t i) {
+            uintptr_t bit = uintptr_t(1) << (i & 63);
+            uintptr_t *w = &this->marks[i >> 6];
+            if (__atomic_load_n(w, __ATOMIC_RELAXED) & bit)
+                return false;
+            return !(__atomic_fetch_or(w, bit, __ATOMIC_RELAXED) & bit);
+        }
+        void clear_marks() {
+            memset(this->marks, 0, ((this->cells + 63) >> 6) * sizeof(uintptr_t));
+        }
+
+        Page *next;         // next page of the same size class
+        size_t cell_words;
+        size_t cells;
+        uintptr_t *marks;   // the bitmap, just after this header
+        uintptr_t *first;   // the first cell, just after the bitmap
+    };
+
+    // The object that holds p, a word of a heap object of any space:
+    // its cell, in a mark-sweep page; in a block, as object_start finds
+    // it.  Nothing may be forwarded.
+    uintptr_t* object_containing(uintptr_t *p);
+
+    // A non-moving space: objects never relocate once allocated, so
+    // they may be handed to native code.  Requests are rounded up to a
+    // size class and served from that class's free list.  Collection
+    // only marks; each page is swept when allocation next needs cells
+    // of its class, which rebuilds the free list from the page's mark
+    // bits, so the cost of sweeping is spread over allocation instead
+    // of landing in the pause.
+    class MarkSweepSpace : public core::Space {
+    public:
+        MarkSweepSpace();
+        explicit MarkSweepSpace(Policy const &p);
+        ~MarkSweepSpace();
+
+        virtual void collect();
+
+        size_t collections() const { return this->gc_count; }
+        size_t pages_in_use() const { return this->page_count; }
+
+        // Collections mark with this many threads (see parallel.cpp);
+        // 1, the default, marks on the calling thread alone.
+        void set_mark_threads(size_t n) { this->mark_threads = n ? n : 1; }
+        size_t marking_threads() const { return this->mark_threads; }
+
+        // Incremental mode.  Once over budget, marking starts (roots are
+        // shaded in one short pause) and then goes on a slice at a time
+        // from allocation, every `period` allocations, each slice tracing
+        // for at most slice_ms; stores meanwhile go through the Satb log
+        // and new objects are born marked.  A slice_ms of 0, the
+        // default, collects all at once.  An explicit collect() finishes
+        // any marking under way.
+        void set_incremental(double slice_ms, size_t period = 1024) {
+            this->slice_ms = slice_ms;
+            this->slice_period = period ? period : 1;
+        }
+        bool marking() const { return this->marking_now; }
+        size_t slices() const { return this->slice_count; }
+        // The longest pause so far, in ms: a whole collection, or one
+        // step of an incremental one.
+        double max_pause() const { return this->max_pause_ms; }
+
+        static const size_t class_count = 22;
+        static const size_t class_words[class_count];
+
+    protected:
+        virtual void* refill(core::formatted_t h, size_t n);
+
+        // Mark the object w refers to (if it is one of ours), and queue
+        // it for tracing.
+        void mark_word(uintptr_t w);
+        // Mark the fields of the object in the cell at p.
+        void trace_cell(uintptr_t *p);
+        void drain();
+        void mark_parallel();
+        void mark_slice();
+
+        class Marker : public core::RootVisitor {
+        public:
+            Marker(MarkSweepSpace *s) : space(s) {}
+            virtual void visit(uintptr_t *slot) { space->mark_word(*slot); }
+        private:
+            MarkSweepSpace *space;
+        };
+        // Objects never move here, so a conservative root needs no
+        // pinning: whatever cell it points into is simply marked.  (Nor
+        // does a core::Pin, whose handle is root enough.)
+        class AmbiguousMarker : public core::AmbiguousVisitor {
+        public:
+            AmbiguousMarker(MarkSweepSpace *s) : space(s) {}
+            virtual void visit(uintptr_t w) { space->mark_word((w & ~0x7) | 0x1); }
+        private:
+            MarkSweepSpace *space;
+        };
+        // Objects stay put, so a weakly held one survives as it is, if
+        // marked.
+        class Survivors : public core::WeakVisitor {
+        public:
+            Survivors(MarkSweepSpace *s) : space(s) {}
+            virtual uintptr_t survivor(uintptr_t w);
+        private:
+            MarkSweepSpace *space;
+        };
+
+        MarkStack stack;
+        size_t live_words; // marked by the last collection
+
+    private:
+        struct Free { Free *next; };
+        struct Class {
+            Page *pages;
+            Page **unswept; // link to the first page still to be swept
+            Free *free;
+        };
+
+        static size_t class_of(size_t words);
+        Page* new_page(size_t c, size_t words);
+        void over_budget();
+        void begin_cycle();
+        void end_cycle();
+        void start_marking();
+        void shade_new(void *cell);
+        void note_pause(double ms);
+        void sweep(Class &k);
+        void sweep_large();
+
+        Policy policy;
+        Class classes[class_count + 1]; // the last holds large objects
+        size_t page_count;
+        size_t budget;
+        size_t gc_count;
+        size_t mark_threads;
+        double slice_ms;
+        size_t slice_period;
+        size_t since_slice;
+        bool marking_now;
+        size_t slice_count;
+        double max_pause_ms;
+    };
+};
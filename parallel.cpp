@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+#include <thread>
+#include <vector>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "spaces.h"
+#include "marksweep.h"
+#include "deque.h"
+#include "wordscan.h"
+
+// Parallel marking for MarkSweepSpace.  Each thread traces from its own
+// work-stealing deque and takes from the others' when it runs dry; mark
+// bits are set with an atomic or, so an object reached from two
+// threads at once is traced by just one of them.
+
+namespace spaces {
+    using core::Header;
+
+    namespace {
+        struct MarkWorker {
+            WorkDeque<uintptr_t*> work;
+            size_t live_words;
+            unsigned seed;
+        };
+
+        struct MarkJob {
+            core::Space *space;
+            MarkWorker *workers;
+            size_t count;
+            std::atomic<size_t> active; // workers not looking for work
+        };
+
+        void mark_word(MarkJob &job, MarkWorker &w, uintptr_t word) {
+            if (!(word & 0x1)) // references are the odd tags
+                return;
+            uintptr_t *p = (uintptr_t*) (word & ~0x7);
+            if (!Heap::contains(p))
+                return;
+            Page *pg = Page::of(p);
+            if (pg == 0 || pg->owner != job.space || !pg->holds(p))
+                return;
+            size_t i = pg->index_of(p);
+            if (pg->mark_atomic(i)) {
+                w.live_words += pg->cell_words;
+                w.work.push(pg->cell(i));
+            }
+        }
+
+        void trace_cell(MarkJob &job, MarkWorker &w, uintptr_t *p) {
+            if (p[0] == Header::filler()) // see MarkSweepSpace::trace_cell
+                p++;
+            if (!Header::is_header(p[0])) {
+                mark_word(job, w, p[0]);
+                mark_word(job, w, p[1]);
+                return;
+            }
+            if (Header::is_record(p[0])) {
+                core::Layout const *l = core::Layout::of(p);
+                core::each_record_ref(core::Layout::slots(p), l, 0, l->length(),
+                                      [&](uintptr_t *slot, bool untagged) {
+                    mark_word(job, w, untagged ? *slot | 0x5 : *slot);
+                });
+                return;
+            }
+            size_t i = Header::first_value(p);
+            core::each_ref(p + i, Header::value_words(p), [&](uintptr_t *slot) {
+                mark_word(job, w, *slot);
+            });
+        }
+
+        // Try every other worker once, from a random starting victim.
+        bool steal(MarkJob &job, size_t self, uintptr_t **out) {
+            MarkWorker &w = job.workers[self];
+            w.seed = w.seed * 1103515245 + 12345;
+            size_t first = (w.seed >> 16) % job.count;
+            for (size_t k = 0; k < job.count; k++) {
+                size_t v = (first + k) % job.count;
+                if (v != self && job.workers[v].work.steal(out))
+                    return true;
+            }
+            return false;
+        }
+
+        bool any_work(MarkJob &job) {
+            for (size_t v = 0; v < job.count; v++)
+                if (!job.workers[v].work.looks_empty())
+                    return true;
+            return false;
+        }
+
+        // Marking is over once every worker is idle at once: an idle
+        // worker's deque is empty and it pushes nothing more, and one
+        // only stops being idle (below) before it steals.
+        void run(MarkJob *job, size_t self) {
+            MarkWorker &w = job->workers[self];
+            uintptr_t *p;
+            for (;;) {
+                if (w.work.pop(&p) || steal(*job, self, &p)) {
+                    trace_cell(*job, w, p);
+                    continue;
+                }
+                job->active.fetch_sub(1);
+                for (;;) {
+                    if (job->active.load() == 0)
+                        return;
+                    if (any_work(*job)) {
+                        job->active.fetch_add(1);
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        // The roots go onto the first worker's deque; the others start
+        // out by stealing from it.
+        class RootMarker : public core::RootVisitor {
+        public:
+            RootMarker(MarkJob &job) : job(job) {}
+            virtual void visit(uintptr_t *slot) {
+                mark_word(this->job, this->job.workers[0], *slot);
+            }
+        private:
+            MarkJob &job;
+        };
+
+        class AmbiguousRootMarker : public core::AmbiguousVisitor {
+        public:
+            AmbiguousRootMarker(MarkJob &job) : job(job) {}
+            virtual void visit(uintptr_t w) {
+                mark_word(this->job, this->job.workers[0], (w & ~0x7) | 0x1);
+            }
+        private:
+            MarkJob &job;
+        };
+    }
+
+    void MarkSweepSpace::mark_parallel() {
+        MarkJob job;
+        job.space = this;
+        job.count = this->mark_threads;
+        job.workers = new MarkWorker[job.count];
+        job.active.store(job.count);
+        for (size_t v = 0; v < job.count; v++) {
+            job.workers[v].live_words = 0;
+            job.workers[v].seed = unsigned(v) * 2654435761u + 1;
+        }
+
+        RootMarker m(job);
+        this->visit_roots(m);
+        AmbiguousRootMarker am(job);
+        this->visit_stack(am);
+
+        std::vector<std::thread> threads;
+        for (size_t v = 1; v < job.count; v++)
+            threads.push_back(std::thread(run, &job, v));
+        run(&job, 0);
+        for (size_t v = 0; v < threads.size(); v++)
+            threads[v].join();
+
+        for (size_t v = 0; v < job.count; v++)
+            this->live_words += job.workers[v].live_words;
+        delete[] job.workers;
+    }
+}
@@ -0,0 +1,183 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "spaces.h"
+#include "region.h"
+#include "wordscan.h"
+
+namespace spaces {
+    using core::Slot;
+    using core::each_slot;
+
+    RegionSpace::RegionSpace()
+        : BlockSpace(), parent(0), innermost(0), spare(0), releasing(), promoted_count(0),
+          promotion(this, 0, &core::Space::gcalloc_on) {}
+
+    RegionSpace::RegionSpace(Policy const &p)
+        : BlockSpace(p), parent(0), innermost(0), spare(0), releasing(), promoted_count(0),
+          promotion(this, 0, &core::Space::gcalloc_on) {}
+
+    RegionSpace::RegionSpace(core::Space &parent)
+        : BlockSpace(), parent(&parent), innermost(0), spare(0), releasing(), promoted_count(0),
+          promotion(this, &parent, &core::Space::gcalloc_on) {
+        parent.add_region(this);
+    }
+
+    RegionSpace::RegionSpace(core::Space &parent, Policy const &p)
+        : BlockSpace(p), parent(&parent), innermost(0), spare(0), releasing(), promoted_count(0),
+          promotion(this, &parent, &core::Space::gcalloc_on) {
+        parent.add_region(this);
+    }
+
+    RegionSpace::~RegionSpace() {
+        assert(this->innermost == 0); // GUMP: scopes close first
+        if (this->parent)
+            this->parent->remove_region(this);
+        while (this->spare) {
+            Block *b = this->spare;
+            this->spare = b->link;
+            Heap::give(b, b->units);
+        }
+    }
+
+    // A spare block, if any, goes in as the current one; the rest is as
+    // for any block space.
+    void* RegionSpace::refill(core::formatted_t h, size_t n) {
+        if (n <= this->policy.large_words() && this->spare &&
+            (this->current == 0 || size_t(this->current->end() - this->cursor) < n)) {
+            this->retire();
+            Block *b = this->spare;
+            this->spare = b->link;
+            b->link = 0;
+            if (this->last)
+                this->last->link = b;
+            else
+                this->blocks = b;
+            this->last = b;
+            this->block_count++;
+            this->current = b;
+            this->cursor = this->limit = b->start();
+        }
+        return BlockSpace::refill(h, n);
+    }
+
+    // The current block is always the last; a block that is retired for
+    // want of room is full as far as its cursor.
+    RegionSpace::Mark RegionSpace::mark() {
+        Mark m = { this->last, this->last ? this->fill(this->last) : 0, this->large.first() };
+        return m;
+    }
+
+    // An object that ends at or before the mark starts before it, so an
+    // interior reference is judged as its object would be.
+    bool RegionSpace::released(uintptr_t w) {
+        if (!this->promotion.mine(w))
+            return false;
+        uintptr_t *p = (uintptr_t*) (w & ~0x7);
+        Block *b = Block::of(p);
+        if (b->flags & Block::released)
+            return true;
+        return b == this->releasing.last && p >= (uintptr_t*) this->releasing.cursor;
+    }
+
+    class RegionSpace::Escapes : public core::RootVisitor {
+    public:
+        Escapes(RegionSpace *r) : region(r) {}
+        virtual void visit(uintptr_t *slot) {
+            if (!this->region->released(*slot))
+                return;
+            assert(this->region->parent != 0); // GUMP: a value outlived its region scope
+            *slot = this->region->promotion.promote(*slot);
+        }
+    private:
+        RegionSpace *region;
+    };
+
+    class RegionSpace::Released : public core::WeakVisitor {
+    public:
+        Released(RegionSpace *r) : region(r) {}
+        virtual uintptr_t survivor(uintptr_t w) {
+            return this->region->released(w) ? 0 : w;
+        }
+    private:
+        RegionSpace *region;
+    };
+
+    void RegionSpace::release(Mark const &m) {
+        this->releasing = m;
+        for (Block *b = m.last ? m.last->link : this->blocks; b; b = b->link)
+            b->flags |= Block::released;
+        for (Block *b = this->large.first(); b != m.large; b = b->link)
+            b->flags |= Block::released;
+
+        // Copy the escapes out, as Shard::share does; the copies go
+        // through the parent, which may collect meanwhile, but the
+        // region's objects stay put.
+        Escapes es(this);
+        this->visit_roots(es);
+        this->promotion.run();
+        this->promoted_count += this->promotion.count();
+        this->promotion.clear();
+        Released rs(this);
+        this->sweep_weak(rs);
+
+        // Then drop the blocks whole, and go on from the mark.
+        Block *b = m.last ? m.last->link : this->blocks;
+        while (b) {
+            Block *n = b->link;
+            b->link = this->spare;
+            b->flags = 0;
+            b->cursor = b->start();
+            this->spare = b;
+            this->block_count--;
+            b = n;
+        }
+        this->large.release(m.large);
+        if (m.last) {
+            m.last->link = 0;
+            m.last->cursor = m.cursor;
+            this->limit = (core::formatted_t*) Heap::card_limit(m.cursor);
+        } else {
+            this->blocks = 0;
+            this->limit = 0;
+        }
+        this->last = this->current = m.last;
+        this->cursor = m.cursor;
+        this->releasing = Mark();
+    }
+
+    void RegionSpace::visit_refs(core::RootVisitor &v) {
+        this->visit_roots(v);
+        this->promotion.visit(v);
+        auto each = [&v](Slot s) {
+            uintptr_t w = s.get(), x = w;
+            v.visit(&x);
+            if (x != w)
+                s.set(x);
+        };
+        for (Block *b = this->blocks; b; b = b->link)
+            for (uintptr_t *p = (uintptr_t*) b->start(); p < (uintptr_t*) this->fill(b); )
+                p += each_slot(p, each);
+        for (Block *b = this->large.first(); b; b = b->link)
+            for (uintptr_t *p = (uintptr_t*) b->start(); p < (uintptr_t*) b->cursor; )
+                p += each_slot(p, each);
+    }
+
+    RegionScope::RegionScope(RegionSpace &r)
+        : region(&r), outer(r.innermost), saved(r.mark()) {
+        r.innermost = this;
+    }
+
+    RegionScope::~RegionScope() {
+        assert(this->region->innermost == this); // GUMP: scopes nest
+        this->region->innermost = this->outer;
+        this->region->release(this->saved);
+    }
+}
@@ -0,0 +1,103 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef REGION_H_INCLUDED
+#error "region.h multiply included"
+#endif
+#define REGION_H_INCLUDED
+
+#ifndef SPACES_H_INCLUDED
+#error "region.h requires previous include: spaces.h"
+#endif
+
+namespace spaces {
+
+    class RegionScope;
+
+    // A region is a space that never collects: it bump-allocates out of
+    // a chain of blocks, and a RegionScope gives back everything
+    // allocated since it opened, all at once, when it closes.  The cost
+    // is one step per block (and large object) given back, whatever
+    // they held; nothing is ever traced.  The ordinary blocks go on to
+    // serve later allocations rather than back to the heap, so that a
+    // region used over and over holds on to its high-water mark.  For
+    // data that dies with the request or step that made it.
+    //
+    // A value that a scope's closing would free but that a root of the
+    // region (a handle, local or region of its own) still holds has
+    // escaped.  A region made with a parent space copies each escaped
+    // value into the parent, with whatever it reaches in the region,
+    // and points the root at the copy; the copy shares no structure
+    // with what stays in the region.  A region without one takes an
+    // escape for a bug (GUMP).  Escapes through the heap are not
+    // caught: no object that outlives a scope may refer to one of its
+    // objects.
+    //
+    // The region's objects may refer into its parent, which takes the
+    // region's roots and every one of its objects as roots of its own,
+    // so a collection of the parent costs one pass over the region.
+    // Nothing of the parent may refer into the region.
+    class RegionSpace : public BlockSpace, public core::RootRegion {
+    public:
+        RegionSpace();
+        explicit RegionSpace(Policy const &p);
+        explicit RegionSpace(core::Space &parent);
+        RegionSpace(core::Space &parent, Policy const &p);
+        ~RegionSpace();
+
+        // Objects copied out to the parent by escapes, so far.
+        size_t promotions() const { return this->promoted_count; }
+
+        // The region's references into its parent.
+        virtual void visit_refs(core::RootVisitor &v);
+
+    protected:
+        virtual void* refill(core::formatted_t h, size_t n);
+
+    private:
+        friend class RegionScope;
+        // Where allocation stood when a scope opened.
+        struct Mark {
+            Block *last;
+            core::formatted_t *cursor;
+            Block *large;
+        };
+        Mark mark();
+        // Give back everything allocated since m, once the escapes are
+        // dealt with.
+        void release(Mark const &m);
+        // Whether w refers, while a release runs, to an object of the
+        // region that it gives back.
+        bool released(uintptr_t w);
+        core::formatted_t* fill(Block *b) {
+            return b == this->current ? this->cursor : b->cursor;
+        }
+        class Escapes;
+        class Released;
+
+        core::Space *parent;
+        RegionScope *innermost;
+        Block *spare; // given back by scopes, for reuse
+        Mark releasing; // while a release runs
+        size_t promoted_count;
+        // While a release runs, the escapes it has copied out; roots of
+        // the parent.
+        Promotion promotion;
+
+        NO_COPY_CTOR(RegionSpace);
+    };
+
+    // Gives back, as it closes, everything its region allocated since it
+    // opened.  Scopes of one region nest, and close innermost first.
+    class RegionScope {
+    public:
+        explicit RegionScope(RegionSpace &r);
+        ~RegionScope();
+
+    private:
+        RegionSpace *region;
+        RegionScope *outer;
+        RegionSpace::Mark saved;
+
+        NO_COPY_CTOR(RegionScope);
+    };
+};
@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "spaces.h"
+#include "copying.h"
+#include "shared.h"
+#include "shard.h"
+#include "wordscan.h"
+
+namespace spaces {
+    using core::Slot;
+    using core::each_slot;
+
+    namespace {
+        // Set the cards of the words in [a, z), a < z, to x.
+        void set_cards(const void *a, const void *z, uint8_t x) {
+            size_t c = Heap::card_of(a);
+            memset(core::Cards::table + c, x, Heap::card_of((uintptr_t*) z - 1) - c + 1);
+        }
+    }
+
+    Shard::Shard(Mutator &m)
+        : CopySpace(), mutator(&m), shared(m.shared), next_shard(0),
+          promotion(this, &m, &core::Space::gcalloc_on) {
+        this->enter();
+    }
+
+    Shard::Shard(Mutator &m, Policy const &p)
+        : CopySpace(p), mutator(&m), shared(m.shared), next_shard(0),
+          promotion(this, &m, &core::Space::gcalloc_on) {
+        this->enter();
+    }
+
+    Shard::~Shard() {
+        SharedSpace::Lock l(this->shared->lock);
+        Shard **p = &this->shared->shards;
+        while (*p != this)
+            p = &(*p)->next_shard;
+        *p = this->next_shard;
+        this->shared->remove_region(this);
+    }
+
+    // A collection holds the lock from start to end, so these need not
+    // wait one out, as a mutator must.
+    void Shard::enter() {
+        SharedSpace::Lock l(this->shared->lock);
+        this->next_shard = this->shared->shards;
+        this->shared->shards = this;
+        this->shared->add_region(this);
+    }
+
+    class Shard::Fixup : public core::RootVisitor {
+    public:
+        Fixup(Shard *s) : shard(s) {}
+        virtual void visit(uintptr_t *slot) {
+            *slot = this->shard->promotion.moved(*slot);
+        }
+    private:
+        Shard *shard;
+    };
+
+    class Shard::Unshared : public core::WeakVisitor {
+    public:
+        Unshared(Shard *s) : shard(s) {}
+        virtual uintptr_t survivor(uintptr_t w) {
+            return this->shard->promotion.moved(w) == w ? w : 0;
+        }
+    private:
+        Shard *shard;
+    };
+
+    // A slot that comes to refer into the shared space dirties its card.
+    void Shard::fix(uintptr_t *start, uintptr_t *end) {
+        for (uintptr_t *p = start; p < end; ) {
+            p += each_slot(p, [this](Slot s) {
+                uintptr_t w = s.get(), x = this->promotion.moved(w);
+                if (x == w)
+                    return;
+                s.set(x);
+                core::Cards::mark(s.at);
+            });
+        }
+    }
+
+    core::handle_t Shard::share(core::handle_t const& h) {
+        if (!this->promotion.mine(h.uint()))
+            return h;
+        assert(this->promotion.count() == 0); // GUMP: one share at a time
+
+        // Copy what h reaches into the shared space; the copies go
+        // through the mutator, which may stop for a collection of the
+        // shared space meanwhile, but the shard's objects stay put.
+        this->promotion.promote(h.uint());
+        this->promotion.run();
+
+        // Then point the whole shard at the copies: the originals are
+        // garbage once nothing refers to them.
+        Fixup fx(this);
+        this->visit_roots(fx);
+        for (Block *b = this->blocks; b; b = b->link)
+            this->fix((uintptr_t*) b->start(), (uintptr_t*) this->fill(b));
+        for (Block *b = this->large.first(); b; b = b->link)
+            this->fix((uintptr_t*) b->start(), (uintptr_t*) b->cursor);
+        Unshared un(this);
+        this->sweep_weak(un);
+        this->promotion.clear();
+        return h;
+    }
+
+    void Shard::remember(uintptr_t *start, uintptr_t *end) {
+        SharedSpace *s = this->shared;
+        for (uintptr_t *p = start; p < end; ) {
+            p += each_slot(p, [s](Slot t) {
+                uintptr_t *q = (uintptr_t*) (t.get() & ~0x7);
+                if (Heap::contains(q) && Block::of(q)->owner == s)
+                    core::Cards::mark(t.at);
+            });
+        }
+    }
+
+    void Shard::remember() {
+        for (Block *b = this->blocks; b; b = b->link) {
+            set_cards(b->start(), b->end(), 0);
+            this->remember((uintptr_t*) b->start(), (uintptr_t*) this->fill(b));
+        }
+        for (Block *b = this->large.first(); b; b = b->link) {
+            set_cards(b->start(), b->cursor, 0);
+            this->remember((uintptr_t*) b->start(), (uintptr_t*) b->cursor);
+        }
+        // What comes after the survivors is new.
+        if (this->current && this->cursor < this->current->end())
+            set_cards(this->cursor, this->current->end(), 1);
+    }
+
+    void Shard::collect() {
+        CopySpace::collect();
+        this->remember();
+    }
+
+    // Polls for a collection of the shared space, but never in the
+    // midst of the shard's own.
+    void* Shard::refill(core::formatted_t h, size_t n) {
+        if (this->collecting)
+            return CopySpace::refill(h, n);
+        this->mutator->safepoint();
+        Block *b = this->current;
+        void *m = CopySpace::refill(h, n);
+        if (this->current != b && Block::of(m) == this->current)
+            set_cards(m, this->current->end(), 1);
+        return m;
+    }
+
+    void Shard::visit_dirty(uintptr_t *start, uintptr_t *end, core::RootVisitor &v) {
+        if (start == end)
+            return;
+        size_t c1 = Heap::card_of(end - 1);
+        for (size_t c = Heap::card_of(start); c <= c1; c++)
+            if (core::Cards::table[c])
+                visit_card(start, end, c, v);
+    }
+
+    void Shard::visit_refs(core::RootVisitor &v) {
+        this->visit_roots(v);
+        this->promotion.visit(v);
+        for (Block *b = this->blocks; b; b = b->link)
+            this->visit_dirty((uintptr_t*) b->start(), (uintptr_t*) this->fill(b), v);
+        for (Block *b = this->large.first(); b; b = b->link)
+            this->visit_dirty((uintptr_t*) b->start(), (uintptr_t*) b->cursor, v);
+    }
+
+    SharedRoot::SharedRoot(SharedSpace &s)
+        : shared(&s), value(core::constants::Literal_null.uint()) {
+        SharedSpace::Lock l(s.lock);
+        s.add_region(this);
+    }
+
+    SharedRoot::~SharedRoot() {
+        SharedSpace::Lock l(this->shared->lock);
+        this->shared->remove_region(this);
+    }
+
+    core::handle_t SharedRoot::get(core::Space &s) {
+        core::handle_t n = s.null();
+        SharedSpace::Lock l(this->shared->lock);
+        return core::handle_t(n, *(core::tagged_t*) &this->value);
+    }
+
+    void SharedRoot::set(core::handle_t const& h) {
+        SharedSpace::Lock l(this->shared->lock);
+        this->value = h.uint();
+    }
+
+    void SharedRoot::visit_refs(core::RootVisitor &v) {
+        v.visit(&this->value);
+    }
+}
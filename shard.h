@@ -0,0 +1,111 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef SHARD_H_INCLUDED
+#error "shard.h multiply included"
+#endif
+#define SHARD_H_INCLUDED
+
+#ifndef SHARED_H_INCLUDED
+#error "shard.h requires previous include: shared.h"
+#endif
+
+namespace spaces {
+
+    // A shard is a thread's own copying space beside a shared space:
+    // what the thread allocates through it, no other thread sees, and
+    // it collects on its own, without stopping anyone.  Its objects may
+    // refer into the shared space (in tagged and closep slots, and in
+    // farptr ones, which are for just that); shared objects never refer
+    // into a shard.  A value goes to another thread by way of share,
+    // which moves it into the shared space first.
+    //
+    // Its remembered set is its cards (see core::Cards): every slot of
+    // the shard that refers into the shared space lies in a dirty card.
+    // Stores dirty their cards, as ever; a block the shard starts
+    // allocating in is dirty throughout; and each of its collections
+    // cleans every card, then dirties again those of the survivors'
+    // slots that refer into the shared space.  A collection of the
+    // shared space (with the shard's thread stopped, as ever) takes the
+    // shard's handles and dirty cards as roots, so its cost follows the
+    // shard's references into it and its newest objects, not its size.
+    //
+    // Make a shard on its mutator's thread, use it only there, as the
+    // mutator, and drop it before the mutator.  The shard's own objects
+    // must be held only by its own handles, locals and regions, and by
+    // its other objects.
+    class Shard : public CopySpace, public core::RootRegion {
+    public:
+        explicit Shard(Mutator &m);
+        Shard(Mutator &m, Policy const &p);
+        ~Shard();
+
+        // A collection of the shard alone.
+        virtual void collect();
+
+        // Move what h reaches of the shard's objects into the shared
+        // space, and make every reference to them, in the shard's
+        // roots and objects, refer to the copies; h is one of those
+        // roots.  Returns h, which then refers into the shared space.
+        // Costs one pass over the whole shard besides the copying, so
+        // share many values at once (gather them in a vec) rather than
+        // one at a time.
+        core::handle_t share(core::handle_t const& h);
+
+        // The shard's references into the shared space, for its
+        // collection.
+        virtual void visit_refs(core::RootVisitor &v);
+
+    protected:
+        virtual void* refill(core::formatted_t h, size_t n);
+
+    private:
+        friend class SharedSpace;
+        // Join the shared space's shards, and its regions.
+        void enter();
+        // Point the slots of the objects in [start, end) at the copies.
+        void fix(uintptr_t *start, uintptr_t *end);
+        class Fixup;
+        // Drops the interned objects that share has copied: their
+        // copies are no one's to intern.
+        class Unshared;
+        // Dirty the cards of the survivors' slots that refer into the
+        // shared space, and clean the others.
+        void remember();
+        void remember(uintptr_t *start, uintptr_t *end);
+        void visit_dirty(uintptr_t *start, uintptr_t *end, core::RootVisitor &v);
+
+        Mutator *mutator;
+        SharedSpace *shared;
+        Shard *next_shard;
+        // While share runs, the copies it has made, through the
+        // mutator; roots of the shared space.
+        Promotion promotion;
+
+        NO_COPY_CTOR(Shard);
+    };
+
+    // A root of a shared space that any thread may read and write: the
+    // way to hand a shared value (see Shard::share) to another thread.
+    // Both take the space's lock, so what a thread stored before its
+    // set is there for the thread that gets the value; a plain store
+    // into a shared object orders nothing.
+    class SharedRoot : public core::RootRegion {
+    public:
+        explicit SharedRoot(SharedSpace &s);
+        ~SharedRoot();
+
+        // The value, as a handle of s (a space of the calling thread:
+        // its mutator or shard).
+        core::handle_t get(core::Space &s);
+        // requires: h does not refer into a shard.
+        void set(core::handle_t const& h);
+
+        virtual void visit_refs(core::RootVisitor &v);
+
+    private:
+        SharedSpace *shared;
+        uintptr_t value;
+
+        NO_COPY_CTOR(SharedRoot);
+    };
+};
@@ -0,0 +1,224 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "spaces.h"
+#include "copying.h"
+#include "shared.h"
+#include "shard.h"
+
+namespace spaces {
+    using core::Header;
+
+    namespace {
+        // Make the n words at m one dead object, which walkers of the
+        // block parse past: a bvl of nym pad.
+        void pad(core::formatted_t *m, size_t n) {
+            uintptr_t *p = (uintptr_t*) m;
+            size_t bytes = (n - 1) * sizeof(uintptr_t);
+            p[0] = Header::bvl(core::headers::pad, bytes).uint();
+            if (bytes >= Header::bvl_kmax) // the length word, then n - 2 words
+                p[1] = ((n - 2) * sizeof(uintptr_t)) << 2;
+        }
+
+        size_t default_tlab(Policy const &p) {
+            size_t w = p.block_words() / 8 / Heap::card_words * Heap::card_words;
+            return w ? w : Heap::card_words;
+        }
+    }
+
+    SharedSpace::SharedSpace()
+        : CopySpace(), stop(false), stopping(false), attached(0), stopped(0),
+          epoch(0), list(0), shards(0), tlab(default_tlab(policy)) {}
+
+    SharedSpace::SharedSpace(Policy const &p, size_t tlab_words)
+        : CopySpace(p), stop(false), stopping(false), attached(0), stopped(0),
+          epoch(0), list(0), shards(0), tlab(default_tlab(p)) {
+        if (tlab_words)
+            this->tlab = (tlab_words + Heap::card_words - 1) / Heap::card_words * Heap::card_words;
+    }
+
+    SharedSpace::~SharedSpace() {
+        assert(this->attached == 0); // GUMP: mutators go first
+    }
+
+    void SharedSpace::attach(Lock &l, Mutator *m) {
+        while (this->stopping)
+            this->resumed.wait(l);
+        m->next_mutator = this->list;
+        this->list = m;
+        this->attached++;
+        this->add_region(m);
+    }
+
+    void SharedSpace::detach(Lock &l, Mutator *m) {
+        while (this->stopping)
+            this->park(l);
+        m->retire_tlab();
+        Mutator **p = &this->list;
+        while (*p != m)
+            p = &(*p)->next_mutator;
+        *p = m->next_mutator;
+        this->attached--;
+        this->remove_region(m);
+    }
+
+    void SharedSpace::park(Lock &l) {
+        uint64_t e = this->epoch;
+        this->stopped++;
+        this->all_stopped.notify_all();
+        this->resumed.wait(l, [this, e] { return this->epoch != e; });
+        this->stopped--;
+    }
+
+    void SharedSpace::collect() {
+        Lock l(this->lock);
+        while (this->stopping)
+            this->resumed.wait(l);
+        this->stop_and_collect(l, false);
+    }
+
+    void SharedSpace::stop_and_collect(Lock &l, bool counted) {
+        if (this->stopping) {
+            this->park(l);
+            return;
+        }
+        this->stopping = true;
+        this->stop.store(true, std::memory_order_release);
+        if (counted)
+            this->stopped++;
+        this->all_stopped.wait(l, [this] { return this->stopped == this->attached; });
+        for (Mutator *m = this->list; m; m = m->next_mutator)
+            m->retire_tlab();
+        CopySpace::collect();
+        this->stop.store(false, std::memory_order_release);
+        this->stopping = false;
+        if (counted)
+            this->stopped--;
+        this->epoch++;
+        this->resumed.notify_all();
+    }
+
+    void SharedSpace::make_room(Lock &l) {
+        while (this->stopping)
+            this->park(l);
+        if (this->block_count + this->large_blocks() >= this->budget)
+            this->stop_and_collect(l, true);
+    }
+
+    void SharedSpace::renew(Lock &l, Mutator *m, size_t n) {
+        this->make_room(l);
+        m->retire_tlab();
+        size_t words = (n + Heap::card_words - 1) / Heap::card_words * Heap::card_words;
+        if (words < this->tlab)
+            words = this->tlab;
+        core::formatted_t *s = this->carve(words);
+        m->cursor = m->limit = s;
+        m->tlab_end = s + words;
+    }
+
+    core::formatted_t* SharedSpace::carve(size_t words) {
+        core::formatted_t *s = 0;
+        if (this->current)
+            s = (core::formatted_t*) Heap::card_limit(this->cursor);
+        if (this->current == 0 || size_t(this->current->end() - s) < words) {
+            Block *b = 0;
+            size_t size = this->policy.block_words();
+            this->retire();
+            status::status_t st = this->request(size > words + Heap::card_words ?
+                                                size : words + Heap::card_words, &b);
+            assert(st.is_success()); // GUMP: assume the heap suffices
+            this->current = b;
+            this->cursor = b->start();
+            s = (core::formatted_t*) Heap::card_limit(this->cursor);
+        }
+        if (s > this->cursor)
+            pad(this->cursor, s - this->cursor);
+        this->cursor = this->limit = s + words;
+        return s;
+    }
+
+    void SharedSpace::visit_pinning(core::AmbiguousVisitor &v) {
+        CopySpace::visit_pinning(v);
+        for (Mutator *m = this->list; m; m = m->next_mutator)
+            m->visit_pins(v);
+        for (Shard *s = this->shards; s; s = s->next_shard)
+            s->visit_pins(v);
+    }
+
+    Mutator::Mutator(SharedSpace &s) : shared(&s), tlab_end(0), next_mutator(0) {
+        SharedSpace::Lock l(s.lock);
+        s.attach(l, this);
+    }
+
+    Mutator::~Mutator() {
+        SharedSpace::Lock l(this->shared->lock);
+        this->shared->detach(l, this);
+    }
+
+    void Mutator::safepoint_slow() {
+        SharedSpace::Lock l(this->shared->lock);
+        while (this->shared->stopping)
+            this->shared->park(l);
+    }
+
+    void Mutator::collect() {
+        SharedSpace::Lock l(this->shared->lock);
+        this->shared->stop_and_collect(l, true);
+    }
+
+    void Mutator::visit_refs(core::RootVisitor &v) {
+        this->visit_roots(v);
+    }
+
+    void Mutator::retire_tlab() {
+        if (this->cursor < this->tlab_end) {
+            pad(this->cursor, this->tlab_end - this->cursor);
+            Heap::note_object(this->cursor, this->tlab_end - this->cursor);
+        }
+        this->cursor = this->limit = this->tlab_end = 0;
+    }
+
+    void* Mutator::refill(core::formatted_t h, size_t n) {
+        this->safepoint();
+        SharedSpace *s = this->shared;
+        if (n > s->policy.large_words()) {
+            SharedSpace::Lock l(s->lock);
+            s->make_room(l);
+            return s->large.alloc(h, n);
+        }
+        if (size_t(this->tlab_end - this->cursor) < n) {
+            SharedSpace::Lock l(s->lock);
+            s->renew(l, this, n);
+        }
+        // As in BlockSpace::refill, the buffer ends at each card edge in
+        // turn, for the offset table.
+        core::formatted_t *m = this->cursor;
+        this->cursor = m + n;
+        m[0] = h;
+        Heap::note_object(m, n);
+        core::formatted_t *c = (core::formatted_t*) Heap::card_limit(this->cursor);
+        this->limit = c < this->tlab_end ? c : this->tlab_end;
+        return m;
+    }
+
+    Mutator::Parked::Parked(Mutator &m) : mutator(&m) {
+        SharedSpace::Lock l(m.shared->lock);
+        m.shared->stopped++;
+        m.shared->all_stopped.notify_all();
+    }
+
+    Mutator::Parked::~Parked() {
+        SharedSpace *s = this->mutator->shared;
+        SharedSpace::Lock l(s->lock);
+        while (s->stopping)
+            s->resumed.wait(l);
+        s->stopped--;
+    }
+}
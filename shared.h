@@ -0,0 +1,155 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef SHARED_H_INCLUDED
+#error "shared.h multiply included"
+#endif
+#define SHARED_H_INCLUDED
+
+#ifndef COPYING_H_INCLUDED
+#error "shared.h requires previous include: copying.h"
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace spaces {
+
+    class Mutator;
+    class Shard;
+
+    // A shared space is a copying space that several threads allocate
+    // in at once, each through a Mutator of its own.  A mutator bump-
+    // allocates out of a thread-local allocation buffer (a TLAB): a run
+    // of whole cards carved out of the space's current block, so that
+    // no two threads ever write the same card's offset table entry.
+    // Only carving a new buffer, and allocating a large object, take
+    // the space's lock; a cons takes none.
+    //
+    // A collection stops the world.  The thread that starts one (the
+    // one whose buffer runs out with the space at its budget, or one
+    // that calls Mutator::collect) raises a flag, and waits until every
+    // other attached thread has reached a safepoint (Mutator::safepoint,
+    // which each refill of a buffer polls) or is parked (see
+    // Mutator::Parked); it then collects, with the handles, locals and
+    // regions of every mutator as roots, and lets them all go.  A thread
+    // that neither allocates nor polls holds up every collection.
+    //
+    // Allocate in the space only through its mutators.  A thread may
+    // keep objects of its own apart, in a Shard.
+    class SharedSpace : public CopySpace {
+    public:
+        SharedSpace();
+        explicit SharedSpace(Policy const &p, size_t tlab_words = 0);
+        ~SharedSpace();
+
+        // Words in each thread-local buffer (whole cards).
+        size_t tlab_words() const { return this->tlab; }
+        size_t mutators() const { return this->attached; }
+
+        // From a thread with no Mutator: stops the world as any
+        // mutator would.
+        virtual void collect();
+
+    protected:
+        virtual void visit_pinning(core::AmbiguousVisitor &v);
+
+    private:
+        friend class Mutator;
+        friend class Shard;
+        friend class SharedRoot;
+        typedef std::unique_lock<std::mutex> Lock;
+
+        // Everything below requires the lock.
+        void attach(Lock &l, Mutator *m);
+        void detach(Lock &l, Mutator *m);
+        // Wait out the running collection, as a stopped thread.
+        void park(Lock &l);
+        // Stop the world and collect, or, if another mutator got there
+        // first, wait for its collection.  counted: the caller is an
+        // attached thread, and so one of those to stop.
+        void stop_and_collect(Lock &l, bool counted);
+        // As a mutator about to allocate: wait out a running collection,
+        // then start one if the space is at its budget.
+        void make_room(Lock &l);
+        // Give m a fresh buffer with room for n words.
+        void renew(Lock &l, Mutator *m, size_t n);
+        // A run of words (whole cards) of the current block, from a
+        // card edge.
+        core::formatted_t* carve(size_t words);
+
+        std::mutex lock;
+        std::condition_variable all_stopped, resumed;
+        std::atomic<bool> stop;  // polled at safepoints
+        bool stopping;           // a collection is waiting or running
+        size_t attached, stopped;
+        uint64_t epoch;          // collections finished
+        Mutator *list;
+        Shard *shards;
+        size_t tlab;
+
+        NO_COPY_CTOR(SharedSpace);
+    };
+
+    // A thread's way into a shared space: a space in its own right,
+    // holding the thread's handles and locals (its roots), and its
+    // allocation buffer.  Make one on the thread that will use it, and
+    // use it (and the handles it makes) on that thread only; a value
+    // goes from one thread to another through the heap, never in a
+    // Handle.  Its objects are the shared space's, and last as long as
+    // some thread's roots reach them.  Every handle and local of a
+    // mutator must be gone before it is.
+    //
+    // Pins work on a mutator as on any space; the conservative root
+    // mode does not, since the stack the collection would scan is its
+    // own thread's.
+    class Mutator : public core::Space, public core::RootRegion {
+    public:
+        explicit Mutator(SharedSpace &s);
+        ~Mutator();
+
+        // Let a waiting collection go ahead.  Allocation polls this on
+        // every refill of the buffer; a loop that runs long without
+        // allocating should poll it itself.
+        void safepoint() {
+            if (this->shared->stop.load(std::memory_order_acquire))
+                this->safepoint_slow();
+        }
+
+        // A stop-the-world collection of the shared space.
+        virtual void collect();
+
+        // While one of these is open, its thread counts as stopped, so
+        // that collections need not wait for it: for a thread about to
+        // block (on I/O, say) for a while.  The thread must not touch
+        // the heap meanwhile, except through the bytes of a core::Pin.
+        class Parked {
+        public:
+            explicit Parked(Mutator &m);
+            ~Parked();
+        private:
+            Mutator *mutator;
+            NO_COPY_CTOR(Parked);
+        };
+
+        virtual void visit_refs(core::RootVisitor &v);
+
+    protected:
+        virtual void* refill(core::formatted_t h, size_t n);
+        // The shared space's: interned objects are everyone's.
+        virtual core::Interns* intern_table() { return this->shared->intern_table(); }
+
+    private:
+        friend class SharedSpace;
+        friend class Shard;
+        void safepoint_slow();
+        // Fill what is left of the buffer, so that its block parses.
+        void retire_tlab();
+
+        SharedSpace *shared;
+        core::formatted_t *tlab_end; // of the buffer [.., tlab_end)
+        Mutator *next_mutator;
+
+        NO_COPY_CTOR(Mutator);
+    };
+};
@@ -0,0 +1,347 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+#include <sys/mman.h>
+#include <mutex>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "spaces.h"
+#include "wordscan.h"
+
+namespace spaces {
+    uintptr_t Heap::base = 0;
+    size_t Heap::reserved = 0;
+    uintptr_t Heap::frontier = 0;
+    void **Heap::table = 0;
+    uint8_t *Heap::offsets = 0;
+    Heap::FreeRun *Heap::free_runs = 0;
+
+    namespace {
+        std::mutex heap_lock; // over take and give (see Heap)
+    }
+
+    void Heap::reserve() {
+        size_t bytes = HEAP_RESERVE_BYTES;
+        // Over-reserve by one unit so that the base can be rounded up
+        // to a unit boundary.
+        void *m = mmap(0, bytes + unit_bytes, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        assert(m != MAP_FAILED); // GUMP: assume address space is plentiful
+        base = (uintptr_t(m) + unit_bytes - 1) & ~(unit_bytes - 1);
+        frontier = base;
+
+        size_t table_bytes = (bytes >> unit_shift) * sizeof(void*);
+        void *t = mmap(0, table_bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        assert(t != MAP_FAILED);
+        table = (void**) t;
+
+        size_t cards = bytes >> core::Cards::shift;
+        void *c = mmap(0, 2 * cards, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        assert(c != MAP_FAILED);
+        core::Cards::table = (uint8_t*) c;
+        core::Cards::base = base;
+        core::Cards::size = bytes;
+        offsets = (uint8_t*) c + cards;
+        reserved = bytes;
+    }
+
+    void Heap::enter(void *m, size_t units) {
+        size_t first = (uintptr_t(m) - base) >> unit_shift;
+        for (size_t i = 0; i < units; i++)
+            table[first + i] = m;
+    }
+
+    void* Heap::take(size_t units) {
+        std::lock_guard<std::mutex> l(heap_lock);
+        if (reserved == 0)
+            reserve();
+
+        // First fit among the runs that have been given back.
+        for (FreeRun **p = &free_runs; *p; p = &(*p)->link) {
+            FreeRun *r = *p;
+            if (r->units < units)
+                continue;
+            if (r->units == units) {
+                *p = r->link;
+            } else {
+                FreeRun *rest = (FreeRun*) ((char*)r + (units << unit_shift));
+                rest->link = r->link;
+                rest->units = r->units - units;
+                *p = rest;
+            }
+            r->link = 0;
+            r->units = 0;
+            enter(r, units);
+            return r;
+        }
+
+        size_t bytes = units << unit_shift;
+        if (frontier + bytes > base + reserved)
+            return 0;
+        void *m = (void*) frontier;
+        int err = mprotect(m, bytes, PROT_READ | PROT_WRITE);
+        assert(err == 0);
+        frontier += bytes;
+        enter(m, units);
+        return m;
+    }
+
+    void Heap::give(void *m, size_t units) {
+        // Drop the backing pages; writing the free-list link below
+        // faults the first one back in, and take clears it again.
+        std::lock_guard<std::mutex> l(heap_lock);
+        size_t bytes = units << unit_shift;
+        madvise(m, bytes, MADV_DONTNEED);
+        FreeRun *r = (FreeRun*) m;
+        r->link = free_runs;
+        r->units = units;
+        free_runs = r;
+        size_t first = (uintptr_t(m) - base) >> unit_shift;
+        for (size_t i = 0; i < units; i++)
+            table[first + i] = 0;
+        size_t card = card_of(m), cards = bytes >> core::Cards::shift;
+        memset(core::Cards::table + card, 0, cards);
+        memset(offsets + card, 0, cards);
+    }
+
+    void Heap::note_object(const void *m, size_t words) {
+        size_t c = card_of(m);
+        note_object(offsets + c, (uintptr_t*) m - (uintptr_t*) card_address(c), words);
+    }
+
+    void Heap::note_object(uint8_t *entries, size_t at, size_t words) {
+        size_t c = at / card_words, end = at + words;
+        if (at == c * card_words)
+            entries[c] = 0;
+        size_t a = ++c * card_words;
+        if (a >= end)
+            return;
+        entries[c] = uint8_t(a - at);
+        // Card c + d goes back the largest power of two not above d.
+        size_t log = 0;
+        for (size_t d = 1; (c + d) * card_words < end; d++) {
+            if ((size_t(2) << log) <= d)
+                log++;
+            entries[c + d] = uint8_t(card_words + 1 + log);
+        }
+    }
+
+    void Heap::load_offsets(const void *m, const uint8_t *entries, size_t cards) {
+        memcpy(offsets + card_of(m), entries, cards);
+    }
+
+    void visit_card(uintptr_t *start, uintptr_t *end, size_t c, core::RootVisitor &v) {
+        using core::Header;
+        uintptr_t *lo = (uintptr_t*) Heap::card_address(c);
+        uintptr_t *hi = lo + Heap::card_words;
+        if (lo < start) lo = start;
+        if (hi > end) hi = end;
+
+        uintptr_t *p = lo > start ? Heap::covering_start(c) : start;
+
+        while (p < hi) {
+            size_t n = 2, i = 0, j = 2;
+            if (Header::is_record(p[0])) {
+                // Its slots in the card, by its layout.
+                core::Layout const *l = core::Layout::of(p);
+                uintptr_t *s = core::Layout::slots(p);
+                size_t a = lo > s ? lo - s : 0, z = hi > s ? hi - s : 0;
+                if (z > l->length())
+                    z = l->length();
+                if (a < z) {
+                    core::each_record_ref(s, l, a, z, [&v](uintptr_t *slot, bool untagged) {
+                        if (!untagged) {
+                            v.visit(slot);
+                            return;
+                        }
+                        uintptr_t w = *slot | 0x5;
+                        v.visit(&w);
+                        *slot = w & ~uintptr_t(0x7);
+                    });
+                    core::each_far_ref(s, l, a, z, [&v](uintptr_t *slot) {
+                        uintptr_t w = *slot | 0x5;
+                        v.visit(&w);
+                        *slot = w & ~uintptr_t(0x7);
+                    });
+                }
+                p += Header::object_words(p);
+                continue;
+            }
+            if (Header::is_header(p[0])) {
+                n = Header::object_words(p);
+                i = Header::first_value(p);
+                j = i + Header::value_words(p);
+            }
+            uintptr_t *a = p + i < lo ? lo : p + i;
+            uintptr_t *z = p + j > hi ? hi : p + j;
+            if (a < z)
+                core::each_ref(a, z - a, [&v](uintptr_t *slot) { v.visit(slot); });
+            p += n;
+        }
+    }
+
+    LargeObjects::~LargeObjects() {
+        while (this->blocks) {
+            Block *b = this->blocks;
+            this->blocks = b->link;
+            Heap::give(b, b->units);
+        }
+        free(this->queue);
+    }
+
+    core::formatted_t* LargeObjects::alloc(core::formatted_t h, size_t n) {
+        size_t units = Block::units_for(n);
+        void *m = Heap::take(units);
+        assert(m != 0); // GUMP: assume the heap suffices
+        Block *b = new (m) Block(this->owner, units);
+        b->flags = Block::large;
+        b->link = this->blocks;
+        this->blocks = b;
+        this->units += units;
+
+        core::formatted_t *o = b->start();
+        b->cursor = o + n;
+        o[0] = h;
+        Heap::note_object(o, n);
+        size_t c = Heap::card_of(o);
+        memset(core::Cards::table + c, 1, Heap::card_of(o + n - 1) - c + 1);
+        return o;
+    }
+
+    void LargeObjects::condemn() {
+        for (Block *b = this->blocks; b; b = b->link)
+            b->flags |= Block::condemned;
+    }
+
+    void LargeObjects::sweep() {
+        for (Block **l = &this->blocks; *l; ) {
+            Block *b = *l;
+            if (!(b->flags & Block::condemned)) {
+                l = &b->link;
+                continue;
+            }
+            *l = b->link;
+            this->units -= b->units;
+            Heap::give(b, b->units);
+        }
+    }
+
+    void LargeObjects::release(Block *mark) {
+        while (this->blocks != mark) {
+            Block *b = this->blocks;
+            this->blocks = b->link;
+            this->units -= b->units;
+            Heap::give(b, b->units);
+        }
+    }
+
+    void LargeObjects::grow() {
+        this->queue_cap = this->queue_cap ? 2 * this->queue_cap : 64;
+        this->queue = (Block**) realloc(this->queue, this->queue_cap * sizeof(Block*));
+        assert(this->queue != 0); // GUMP: assume mallocs don't fail
+    }
+
+    // As CopySpace::object_of finds it, with nothing forwarded.
+    uintptr_t* Promotion::start_of(uintptr_t w) {
+        using core::Word;
+        using core::Header;
+        uintptr_t *p = (uintptr_t*) (w & ~0x7);
+        switch (Word::variant_of(w)) {
+        case Word::konsref:
+            return p;
+        case Word::valref:
+            if (Word::variant_of(p[0]) == Word::blobmdr)
+                return p - Header::midder_delta(p[0]);
+            return p;
+        default:
+            return object_start(p, [](uintptr_t *s) {
+                return Header::is_header(s[0]) ? Header::object_words(s) : size_t(2);
+            });
+        }
+    }
+
+    uintptr_t Promotion::promote(uintptr_t w) {
+        using core::Word;
+        using core::Header;
+        uintptr_t *p = (uintptr_t*) (w & ~0x7), *o = this->start_of(w);
+        std::unordered_map<uintptr_t*, uintptr_t>::iterator i = this->promoted.find(o);
+        uintptr_t c;
+        if (i != this->promoted.end()) {
+            c = i->second;
+        } else {
+            assert(this->to != 0); // GUMP: there is somewhere to promote to
+            core::formatted_t h = *(core::formatted_t*) o;
+            size_t n = Header::is_header(o[0]) ? Header::object_words(o) : 2, raw = 0;
+            switch (Word::variant_of(o[0])) {
+            case Word::bvlhdr: case Word::blobhdr:
+                raw = Header::first_raw(o);
+                break;
+            default:
+                break;
+            }
+            uintptr_t *q = (uintptr_t*) this->alloc(*this->to, h, n, raw);
+            memcpy(q + 1, o + 1, (n - 1) * sizeof(uintptr_t));
+            if (Header::is_record(o[0])) {
+                // The space promoted to would not trace them.
+                core::Layout const *l = core::Layout::of(o);
+                core::each_far_ref(core::Layout::slots(o), l, 0, l->length(), [](uintptr_t*) {
+                    assert(0); // GUMP: promoted records hold no far pointers
+                });
+            }
+            c = uintptr_t(q) | (Header::is_header(o[0]) ? 0x5 : 0x1);
+            this->promoted[o] = c;
+            this->queue.push_back(c);
+        }
+        return uintptr_t((uintptr_t*) (c & ~0x7) + (p - o)) | (w & 0x7);
+    }
+
+    uintptr_t Promotion::moved(uintptr_t w) {
+        if (!this->mine(w) || this->promoted.find(this->start_of(w)) == this->promoted.end())
+            return w;
+        return this->promote(w);
+    }
+
+    // A slot is found afresh (through the queue) after each promote,
+    // which may have moved the copy that holds it.
+    void Promotion::run() {
+        using core::Slot;
+        std::vector<std::pair<size_t, Slot::Kind> > slots;
+        for (size_t k = 0; k < this->queue.size(); k++) {
+            char *q = (char*) (this->queue[k] & ~0x7);
+            slots.clear();
+            core::each_slot((uintptr_t*) q, [&slots, q](Slot s) {
+                slots.push_back(std::make_pair(size_t((char*) s.at - q), s.kind));
+            });
+            for (size_t j = 0; j < slots.size(); j++) {
+                Slot s = {slots[j].second, q + slots[j].first};
+                uintptr_t w = s.get();
+                if (!this->mine(w))
+                    continue;
+                w = this->promote(w);
+                q = (char*) (this->queue[k] & ~0x7);
+                s.at = q + slots[j].first;
+                s.set(w);
+            }
+        }
+    }
+
+    void Promotion::visit(core::RootVisitor &v) {
+        for (std::unordered_map<uintptr_t*, uintptr_t>::iterator i = this->promoted.begin();
+             i != this->promoted.end(); ++i)
+            v.visit(&i->second);
+        for (size_t i = 0; i < this->queue.size(); i++)
+            v.visit(&this->queue[i]);
+    }
+
+    void Promotion::clear() {
+        this->promoted.clear();
+        this->queue.clear();
+    }
+}
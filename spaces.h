@@ -0,0 +1,406 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef SPACES_H_INCLUDED
+#error "spaces.h multiply included"
+#endif
+#define SPACES_H_INCLUDED
+
+#ifndef CORE_H_INCLUDED
+#error "spaces.h requires previous include: core.h"
+#endif
+#ifndef STATUS_H_INCLUDED
+#error "spaces.h requires previous include: status.h"
+#endif
+
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#ifndef HEAP_RESERVE_BYTES
+#define HEAP_RESERVE_BYTES (size_t(32) << 30)
+#endif
+
+namespace spaces {
+
+    // One malloc per object; no blocks, no bump pointer.  Kept around
+    // as the baseline that the block spaces are measured against.
+    class SimpleSpace : public core::Space {
+        virtual void* refill(core::formatted_t h, size_t n) {
+            size_t bytes = n*sizeof(uintptr_t);
+            core::formatted_t *m = (core::formatted_t*) malloc(bytes);
+            assert(m != 0); // GUMP: assume mallocs don't fail
+            assert((uintptr_t(m) & 0x7) == 0); // GUMP: assume malloc is aligned
+            m[0] = h;
+            return m;
+        }
+    };
+
+    // The heap is a single reservation of address space, carved into
+    // units of 2^unit_shift bytes.  Every block occupies a run of whole
+    // units and starts on a unit boundary; the table maps each unit
+    // back to the start of its run, so finding the block for any heap
+    // address is a subtraction, a shift and a load.
+    class Heap {
+    public:
+        static const size_t unit_shift = 16;
+        static const size_t unit_bytes = size_t(1) << unit_shift;
+
+        static bool contains(const void *p) {
+            return uintptr_t(p) - base < reserved;
+        }
+        // requires: contains(p), and p lies in a run handed out by take.
+        static void* start_of(const void *p) {
+            return table[(uintptr_t(p) - base) >> unit_shift];
+        }
+
+        // The offset table: for each card, where the object covering
+        // its first word starts, so that an interior address can be
+        // taken to its object without scanning up from it, and a card
+        // parsed without parsing its block from the start.  An entry
+        // e <= card_words says "e words before the card"; above that,
+        // "see the card 2^(e - card_words - 1) cards before", so that
+        // the cards within one long object lead back to its start in
+        // logarithmically many steps.
+        //
+        // The allocator records every object that covers the first word
+        // of a card (see BlockSpace::refill); cards a block has not filled
+        // up to, and the card holding the block's own header, have no
+        // meaningful entry.
+        static const size_t card_words = core::Cards::bytes / sizeof(uintptr_t);
+        static void note_object(const void *m, size_t words);
+        // The same, into entries standing for the cards from some card
+        // edge on, for an object that starts at words past that edge:
+        // for laying out a table before the objects are in the heap.
+        static void note_object(uint8_t *entries, size_t at, size_t words);
+        // Enter such entries for the cards from m on, m a card edge.
+        static void load_offsets(const void *m, const uint8_t *entries, size_t cards);
+        static uintptr_t* covering_start(size_t card) {
+            uint8_t e;
+            while ((e = offsets[card]) > card_words)
+                card -= size_t(1) << (e - card_words - 1);
+            return (uintptr_t*) card_address(card) - e;
+        }
+        // The first card edge at or above p.
+        static void* card_limit(const void *p) {
+            return (void*) ((uintptr_t(p) + core::Cards::bytes - 1) &
+                            ~uintptr_t(core::Cards::bytes - 1));
+        }
+        static size_t card_of(const void *p) {
+            return (uintptr_t(p) - base) >> core::Cards::shift;
+        }
+        static void* card_address(size_t card) {
+            return (void*) (base + (card << core::Cards::shift));
+        }
+
+        // Hands out a fresh run of units (zero-filled), or 0 when the
+        // reservation is exhausted.  These two take a lock, so that
+        // spaces on different threads may grow and shrink at once; the
+        // tables of a run belong to whoever holds it.
+        static void* take(size_t units);
+        // Returns a run obtained from take; its pages go back to the OS.
+        static void  give(void *m, size_t units);
+
+    private:
+        static void reserve();
+        static void enter(void *m, size_t units);
+
+        static uintptr_t base;
+        static size_t reserved;    // in bytes; 0 until first take
+        static uintptr_t frontier; // everything above is untouched
+        static void **table;       // one entry per unit
+        static uint8_t *offsets;   // one entry per card
+        struct FreeRun { FreeRun *link; size_t units; };
+        static FreeRun *free_runs;
+    };
+
+    // A block is a unit-aligned run of heap words with its header
+    // stored in place at the front.  Objects live in [start, end);
+    // cursor marks the end of the allocated prefix.
+    class Block {
+    public:
+        enum Flags {
+            condemned = 0x1, // being evacuated by the running collection
+            to_space  = 0x2, // created to hold the running collection's copies
+            pinned    = 0x4, // kept in place by a conservative root
+            large     = 0x8, // holds one large object (see LargeObjects)
+            cells     = 0x10, // carved into cells of one size (see Page)
+            released  = 0x20  // being given back by a region (see RegionScope)
+        };
+
+        Block(core::Space *owner, size_t units)
+            : link(0), owner(owner), units(units),
+              cursor(start()), scan(start()), flags(0) {}
+
+        static Block* of(const void *p) { return (Block*) Heap::start_of(p); }
+        static size_t units_for(size_t words) {
+            size_t bytes = sizeof(Block) + words*sizeof(uintptr_t);
+            return (bytes + Heap::unit_bytes - 1) >> Heap::unit_shift;
+        }
+
+        core::formatted_t* start() { return (core::formatted_t*) (this + 1); }
+        core::formatted_t* end() {
+            return (core::formatted_t*) ((char*)this + (units << Heap::unit_shift));
+        }
+        bool contains(const void *p) {
+            return (void*)start() <= p && p < (void*)end();
+        }
+
+        Block *link;          // next block belonging to the same space
+        core::Space *owner;
+        size_t units;
+        core::formatted_t *cursor;
+        core::formatted_t *scan; // collector's progress through the block
+        uintptr_t flags;
+    };
+
+    // Visit, as roots, the value slots (and the pointer slots of records,
+    // far ones too) that lie in card c of the objects laid out in
+    // [start, end), parsing the card from the object that covers its
+    // first word.  requires: c overlaps [start, end).
+    void visit_card(uintptr_t *start, uintptr_t *end, size_t c, core::RootVisitor &v);
+
+    // The start of the object that holds p, a word of a block: the one
+    // covering the first word of p's card (from the offset table), or
+    // the first in the block, then the objects after it up to p, which
+    // lie in the card.  words(s) is the length of the object at s.
+    template<typename F>
+    uintptr_t* object_start(uintptr_t *p, F words) {
+        size_t c = Heap::card_of(p);
+        uintptr_t *s = (uintptr_t*) Block::of(p)->start();
+        if ((uintptr_t*) Heap::card_address(c) > s)
+            s = Heap::covering_start(c);
+        for (;;) {
+            size_t n = words(s);
+            if (p < s + n)
+                return s;
+            s += n;
+        }
+    }
+
+    // A policy fixes the shape of a block space: how big its blocks are,
+    // which requests bypass the shared buffer entirely, and (for spaces
+    // that collect) how many blocks may fill before a collection.
+    class Policy {
+    public:
+        Policy()
+            : block_words_(32*1024), large_words_(4*1024), heap_blocks_(64) {}
+        Policy(size_t block_words, size_t large_words, size_t heap_blocks = 64)
+            : block_words_(block_words), large_words_(large_words),
+              heap_blocks_(heap_blocks) {
+            assert(large_words <= block_words);
+        }
+
+        // Words of object storage in an ordinary block.
+        size_t block_words() const { return block_words_; }
+        // Requests of more than this many words go to the space's large
+        // objects (see LargeObjects), so that one big object never
+        // forces the current buffer to be retired with most of it
+        // unused, nor gets copied by a collection.
+        size_t large_words() const { return large_words_; }
+        // Initial collection trigger, in blocks; a collecting space may
+        // raise its own trigger when survivors fill much of it.
+        size_t heap_blocks() const { return heap_blocks_; }
+
+    private:
+        size_t block_words_;
+        size_t large_words_;
+        size_t heap_blocks_;
+    };
+
+    // The large objects of a space, each alone in a block of whole
+    // units: so page-aligned, with no pages committed beyond those the
+    // object touches, and given back to the heap (its pages dropped)
+    // as soon as a collection finds it dead.  They are never copied.
+    // A collection condemns them all, keeps those it reaches by
+    // clearing the flag in place and queueing them for scanning, and
+    // then sweeps the rest away.
+    class LargeObjects {
+    public:
+        explicit LargeObjects(core::Space *owner)
+            : owner(owner), blocks(0), units(0), queue(0), queued(0), queue_cap(0) {}
+        ~LargeObjects();
+
+        // A block for an object of n words, with h stored in its first.
+        // Every card of the object starts dirty, since it is filled in
+        // without the write barrier.
+        core::formatted_t* alloc(core::formatted_t h, size_t n);
+
+        Block* first() const { return this->blocks; }
+        size_t units_in_use() const { return this->units; }
+
+        void condemn();
+        // requires: b is one of these, and condemned.
+        void keep(Block *b) {
+            b->flags &= ~Block::condemned;
+            if (this->queued == this->queue_cap)
+                this->grow();
+            this->queue[this->queued++] = b;
+        }
+        // The next kept object whose fields remain to be scanned, or 0.
+        uintptr_t* next_to_scan() {
+            return this->queued ? (uintptr_t*) this->queue[--this->queued]->start() : 0;
+        }
+        // Give back every object still condemned.
+        void sweep();
+        // Give back every object allocated since mark was first(), the
+        // newest first: a region's bulk free (see RegionScope).
+        void release(Block *mark);
+
+    private:
+        void grow();
+
+        core::Space *owner;
+        Block *blocks;
+        size_t units;
+        Block **queue; // kept, not yet scanned
+        size_t queued, queue_cap;
+
+        NO_COPY_CTOR(LargeObjects);
+    };
+
+    // Copies objects of one space into another, with whatever they
+    // reach in the first, Cheney-style: the queue of copies stands for
+    // the scan pointer.  The objects copied stay put; the copies may
+    // move, as each copy allocates, so they are held (in promoted and
+    // queue) as roots of the second space, through visit, until clear.
+    // For a region's escapes and a shard's shared values.
+    class Promotion {
+    public:
+        // gcalloc on a space, or gcalloc_raw if raw is not 0 (see
+        // core::Space::gcalloc_on).
+        typedef void* (*Alloc)(core::Space &s, core::formatted_t h, size_t n, size_t raw);
+        Promotion(core::Space *from, core::Space *to, Alloc alloc)
+            : from(from), to(to), alloc(alloc), promoted(), queue() {}
+
+        // Whether w refers to an object of from.
+        bool mine(uintptr_t w) const {
+            if (!(w & 0x1)) // references are the odd tags
+                return false;
+            uintptr_t *p = (uintptr_t*) (w & ~0x7);
+            return Heap::contains(p) && Block::of(p)->owner == this->from;
+        }
+        // w, which refers into from, as it refers into to: copying its
+        // object there unless it has been already.
+        uintptr_t promote(uintptr_t w);
+        // w, as promote would give it, if its object has been copied;
+        // otherwise w.
+        uintptr_t moved(uintptr_t w);
+        // Promote whatever the copies refer to in from, and so on, until
+        // they refer to nothing there.
+        void run();
+        // Objects copied since the last clear.
+        size_t count() const { return this->queue.size(); }
+        void visit(core::RootVisitor &v);
+        void clear();
+
+    private:
+        uintptr_t* start_of(uintptr_t w);
+
+        core::Space *from, *to;
+        Alloc alloc;
+        // Each object copied -> a reference to the copy, and the copies
+        // in order, as they await a scan.
+        std::unordered_map<uintptr_t*, uintptr_t> promoted;
+        std::vector<uintptr_t> queue;
+
+        NO_COPY_CTOR(Promotion);
+    };
+
+    // A block space bump-allocates out of its current block (through
+    // the inline fast path in core::Space::gcalloc) and only comes
+    // back here to swap in a new block when that one fills up.
+    template<typename Block>
+    class Space : public core::Space {
+    public:
+        Space()
+            : policy(), blocks(0), last(0), current(0),
+              block_count(0), fresh_flags(0), large(this) {}
+        explicit Space(Policy const &p)
+            : policy(p), blocks(0), last(0), current(0),
+              block_count(0), fresh_flags(0), large(this) {}
+        ~Space() {
+            while (this->blocks) {
+                Block *b = this->blocks;
+                this->blocks = b->link;
+                Heap::give(b, b->units);
+            }
+        }
+
+        Policy const& get_policy() const { return this->policy; }
+        // Words allocated out of the space's blocks, so far.
+        size_t words_in_use() const {
+            size_t n = 0;
+            for (Block *b = this->blocks; b; b = b->link)
+                n += (b == this->current ? this->cursor : b->cursor) - b->start();
+            return n;
+        }
+        // Heap units held by its large objects.
+        size_t large_units() const { return this->large.units_in_use(); }
+
+    protected:
+        // Obtain a block with room for at least size words.
+        status::status_t request(size_t size, RECV_T(Block*) recv) {
+            size_t units = Block::units_for(size);
+            void *m = Heap::take(units);
+            if (m == 0)
+                return status::Status::failure();
+            Block *b = new (m) Block(this, units);
+            b->flags = this->fresh_flags;
+            if (this->last)
+                this->last->link = b;
+            else
+                this->blocks = b;
+            this->last = b;
+            this->block_count++;
+            SET_RECV(recv, b);
+            return status::Status::success();
+        }
+
+        // Record how far the current block was filled, so that the
+        // block can be walked object-by-object later.
+        void retire() {
+            if (this->current)
+                this->current->cursor = this->cursor;
+            this->current = 0;
+            this->cursor = this->limit = 0;
+        }
+
+        virtual void* refill(core::formatted_t h, size_t n) {
+            Block *b = 0;
+            if (n > this->policy.large_words())
+                return this->large.alloc(h, n);
+            if (this->current == 0 || size_t(this->current->end() - this->cursor) < n) {
+                this->retire();
+                status::status_t s = this->request(this->policy.block_words(), &b);
+                assert(s.is_success()); // GUMP: assume the heap suffices
+                this->current = b;
+                this->cursor = b->start();
+            }
+            // The buffer ends at each card edge in turn, so that every
+            // object that reaches one comes through here, to be entered
+            // in the offset table.
+            core::formatted_t *m = this->cursor;
+            this->cursor = m + n;
+            m[0] = h;
+            Heap::note_object(m, n);
+            this->limit = (core::formatted_t*) Heap::card_limit(this->cursor);
+            return m;
+        }
+
+    protected:
+        Policy policy;
+        Block *blocks;  // every block of the space, oldest first
+        Block *last;    // the most recent block
+        Block *current; // the block behind [cursor, limit), if any
+        size_t block_count;
+        uintptr_t fresh_flags; // Block::Flags given to each new block
+        LargeObjects large;
+
+        // The units of the large objects, counted in ordinary blocks.
+        size_t large_blocks() const {
+            return this->large.units_in_use() / Block::units_for(this->policy.block_words());
+        }
+    };
+
+    typedef Space<Block> BlockSpace;
+};
@@ -17,6 +17,8 @@ namespace status {
     public:
         static Status success() { return Status(0); }
         static Status failure() { return Status(-1); }
+    public:
+        bool is_success() const { return value == 0; }
     };
     typedef Status status_t;
 
@@ -1,35 +1,28 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <cassert>
+#include <vector>
+#include <unistd.h>
 
 #include "ctors.h"
 #include "status.h"
 #include "recv.h"
+#include "trace.h"
 #include "core.h"
-
-namespace spaces {
-
-    class SimpleSpace : public core::Space {
-        virtual void* gcalloc(core::formatted_t h, size_t n) {
-            size_t bytes = n*sizeof(uintptr_t);
-            void *m = malloc(bytes);
-            assert(m != 0); // GUMP: assume mallocs don't fail
-            assert((uintptr_t(m) & 0x7) == 0); // GUMP: assume malloc is aligned
-            return m;
-        }
-    };
-
-    class Policy {
-        
-    };
-
-    template<typename Block>
-    class Space {
-        status::status_t request(size_t size, Block *recv);
-    };
-};
+#include "spaces.h"
+#include "copying.h"
+#include "gen.h"
+#include "marksweep.h"
+#include "wordscan.h"
+#include "image.h"
+#include "wire.h"
+#include "shared.h"
+#include "shard.h"
+#include "intern.h"
+#include "region.h"
 
 #include <iostream>
+#include <thread>
 
 int main()
 {
@@ -75,5 +68,565 @@ int main()
     std::cout << "     l3:is_null:" << l.is_null() << "\n";
 
     // core::handle_t x = l.pair_car();
+
+    // Successive conses out of a block space are adjacent in memory.
+    spaces::BlockSpace b;
+    core::handle_t m = b.null();
+    m = b.cons(core::FixInt(2), m);
+    uintptr_t m2 = m.uint();
+    m = b.cons(core::FixInt(1), m);
+    uintptr_t m1 = m.uint();
+    std::cout << "     m:adjacent:" << (m2 + 2*sizeof(uintptr_t) == m1) << "\n";
+    assert(m2 + 2*sizeof(uintptr_t) == m1);
+
+    // A collection moves what the handles reach and drops the rest.
+    spaces::CopySpace c;
+    core::handle_t n = c.null();
+    n = c.cons(core::FixInt(3), n);
+    n = c.cons(core::FixInt(2), n);
+    c.cons(core::FixInt(0), n); // garbage
+    n = c.cons(core::FixInt(1), n);
+    uintptr_t n0 = n.uint();
+    c.collect();
+    std::cout << "     n:moved:" << (n.uint() != n0) << "\n";
+    assert(n.uint() != n0);
+    for (intptr_t k = 1; k <= 3; k++, n = n.seq_cdr())
+        assert(n.seq_car().fixint_value() == k);
+    assert(n.is_null());
+
+    // Lists reached together come out of a collection one after the
+    // other, each in consecutive cells, rather than interleaved.
+    spaces::CopySpace co;
+    core::handle_t ev = co.null(), od = co.null();
+    for (intptr_t k = 4; k > 0; k--) {
+        ev = co.cons(core::FixInt(2 * k), ev);
+        od = co.cons(core::FixInt(2 * k - 1), od);
+    }
+    co.collect();
+    std::cout << "     ev:linear:" << (ev.seq_cdr().uint() == ev.uint() + 2*sizeof(uintptr_t)) << "\n";
+    for (core::handle_t e = ev; !e.seq_cdr().is_null(); e = e.seq_cdr())
+        assert(e.seq_cdr().uint() == e.uint() + 2*sizeof(uintptr_t));
+
+    // A young object stored into an old pair survives a minor
+    // collection through the card the store dirtied.
+    spaces::GenSpace g;
+    core::handle_t o = g.cons(core::FixInt(0), g.null());
+    g.collect_minor();
+    o.pair_setcar(g.cons(core::FixInt(5), g.null()));
+    g.collect_minor();
+    std::cout << "     o:minors:" << g.minor_collections() << "\n";
+    assert(o.pair_car().seq_car().fixint_value() == 5);
+
+    // Mark-sweep leaves survivors where they are, and hands the cells
+    // of the dead back out once their page is swept.
+    spaces::MarkSweepSpace ms;
+    core::handle_t q = ms.cons(core::FixInt(1), ms.null());
+    uintptr_t q0 = q.uint();
+    uintptr_t dead = ms.cons(core::FixInt(2), ms.null()).uint();
+    ms.collect();
+    core::handle_t r = ms.cons(core::FixInt(3), q);
+    std::cout << "     q:pinned:" << (q.uint() == q0) << "\n";
+    assert(q.uint() == q0 && q.seq_car().fixint_value() == 1);
+    assert(r.uint() == dead);
+
+    // Marking on several threads finds the same survivors.
+    spaces::MarkSweepSpace pm;
+    pm.set_mark_threads(4);
+    core::handle_t u = pm.null();
+    for (intptr_t k = 1000; k > 0; k--) {
+        u = pm.cons(core::FixInt(k), u);
+        pm.cons(core::FixInt(-k), pm.null()); // garbage
+    }
+    pm.collect();
+    for (intptr_t k = 1; k <= 1000; k++, u = u.seq_cdr())
+        assert(u.seq_car().fixint_value() == k);
+    std::cout << "     u:collections:" << pm.collections() << "\n";
+
+    // Incremental marking: a list unlinked during marking and stored
+    // elsewhere survives, by way of the barrier's log.
+    spaces::MarkSweepSpace im(spaces::Policy(8 * 1024, 256, 1));
+    im.set_incremental(1e-9, 1); // slices as short as they come
+    core::handle_t hold = im.cons(im.cons(core::FixInt(1), im.null()),
+                                  im.cons(core::FixInt(0), im.null()));
+    while (!im.marking())
+        im.cons(core::FixInt(0), im.null());
+    core::handle_t moved = hold.pair_car();
+    hold.pair_setcar(im.null());
+    hold.pair_setcdr(moved);
+    moved = im.null();
+    while (im.marking())
+        im.cons(core::FixInt(0), im.null());
+    for (int k = 0; k < 1000; k++)
+        im.cons(core::FixInt(2), im.null());
+    std::cout << "     hold:slices:" << im.slices() << "\n";
+    assert(hold.pair_cdr().seq_car().fixint_value() == 1);
+
+    // Locals are roots as handles are, and go in bulk with their scope.
+    spaces::CopySpace lc;
+    {
+        core::HandleScope scope(lc);
+        core::local_t v = lc.local(lc.null());
+        v = lc.cons(core::FixInt(2), v);
+        v = lc.cons(core::FixInt(1), v);
+        uintptr_t v0 = v.uint();
+        {
+            core::HandleScope inner(lc);
+            lc.cons(core::FixInt(0), v); // garbage once inner closes
+        }
+        lc.collect();
+        std::cout << "     v:moved:" << (v.uint() != v0) << "\n";
+        assert(v.uint() != v0 && v.seq_car().fixint_value() == 1);
+        assert(v.seq_cdr().seq_car().fixint_value() == 2);
+    }
+
+    // In the conservative root mode raw values on the stack are roots,
+    // and what they refer to is pinned rather than moved.
+    spaces::CopySpace cr;
+    cr.set_conservative_roots(true);
+    core::tagged_t rl = cr.cons_raw(core::FixInt(2), core::constants::Literal_null);
+    rl = cr.cons_raw(core::FixInt(1), rl);
+    uintptr_t rl0 = rl.uint();
+    cr.collect();
+    std::cout << "     rl:pinned:" << (rl.uint() == rl0) << "\n";
+    assert(rl.uint() == rl0 && rl.seq_cdr().seq_car().fixint_value() == 2);
+
+    // A cdr-coded run reads as any other list, and keeps its shape
+    // (and the cells within it) across a collection.
+    spaces::CopySpace rc;
+    core::FixInt digits[] = { core::FixInt(1), core::FixInt(2), core::FixInt(3) };
+    core::handle_t run = rc.list_from(digits, digits + 3);
+    core::handle_t two = run.seq_cdr();
+    rc.collect();
+    std::cout << "     run:is_snok:" << two.is_snok() << "\n";
+    assert(two.uint() == run.uint() + sizeof(uintptr_t));
+    for (intptr_t k = 1; k <= 3; k++, run = run.seq_cdr())
+        assert(run.seq_car().fixint_value() == k);
+    assert(run.is_null());
+
+    // A reference deep into a long object finds its start through the
+    // offset table, and moves with it.
+    spaces::CopySpace ic;
+    std::vector<core::FixInt> many;
+    for (intptr_t k = 0; k < 3000; k++)
+        many.push_back(core::FixInt(k));
+    core::handle_t deep = ic.list_from(many.begin(), many.end());
+    for (int k = 0; k < 2500; k++)
+        deep = deep.seq_cdr();
+    uintptr_t deep0 = deep.uint();
+    ic.collect();
+    std::cout << "     deep:moved:" << (deep.uint() != deep0) << "\n";
+    assert(deep.uint() != deep0 && deep.seq_car().fixint_value() == 2500);
+
+    // The batch classifier finds exactly the references of a span, at
+    // every length and alignment.
+    uintptr_t span[64 + 3];
+    for (size_t k = 0; k < 64 + 3; k++)
+        span[k] = k % 3 ? core::FixInt(k).uint() : (k * 8) | (k & 6) | 1;
+    for (size_t off = 0; off < 3; off++)
+        for (size_t len = 0; len <= 64; len++) {
+            uint64_t m = 0;
+            for (size_t k = 0; k < len; k++)
+                if (core::Word::variant_of(span[off + k]) <= core::Word::intrref)
+                    m |= uint64_t(1) << k;
+            assert(core::ref_mask(span + off, len) == m);
+        }
+    std::cout << "     span:refs:" << __builtin_popcountll(core::ref_mask(span, 64)) << "\n";
+
+    // Vecs, bvls and blobs, past the lengths their headers can hold.
+    // A large one stays where it is through a collection, which gives
+    // back the dead ones.
+    spaces::CopySpace ls;
+    core::handle_t big = ls.make_vec(core::headers::vec, 10000, ls.cons(core::FixInt(8), ls.null()));
+    core::handle_t bytes = ls.make_bvl(core::headers::bvl, 9000);
+    core::handle_t bl = ls.make_blob(core::headers::blob, 40, core::FixInt(1), 300);
+    bytes.bvl_set(8999, 0xab);
+    bl.blob_set(299, 0xcd);
+    bl.blob_store(39, big);
+    ls.make_vec(core::headers::vec, 20000, core::FixInt(0));
+    uintptr_t big0 = big.uint();
+    size_t units0 = ls.large_units();
+    ls.collect();
+    std::cout << "     los:units:" << units0 << "->" << ls.large_units() << "\n";
+    assert(big.uint() == big0 && ls.large_units() < units0);
+    assert(big.vec_value_capacity() == 10000);
+    assert(big.vec_fetch(9999).seq_car().fixint_value() == 8);
+    assert(bytes.bvl_byte_capacity() == 9000 && bytes.bvl_get(8999) == 0xab);
+    assert(bl.blob_val_capacity() == 40 && bl.blob_raw_capacity() == 300);
+    assert(bl.blob_get(299) == 0xcd && bl.blob_fetch(39).uint() == big.uint());
+
+    // Raw bytes start aligned, in every space and after a collection,
+    // and take bulk work.
+    spaces::MarkSweepSpace as;
+    for (size_t k = 0; k < 16; k++) {
+        core::Bytes ab = as.make_blob(core::headers::blob, k, core::FixInt(0), 8 * k).blob_raw();
+        assert(uintptr_t(ab.data()) % core::Header::raw_align == 0);
+    }
+    spaces::CopySpace bs;
+    core::handle_t b1 = bs.make_bvl(core::headers::bvl, 100);
+    core::handle_t b2 = bs.make_blob(core::headers::blob, 3, core::FixInt(0), 64);
+    b1.bvl_raw().fill(0, 100, 7);
+    b1.bvl_set(60, 9);
+    b2.blob_raw().copy(0, b1.bvl_raw(), 40, 60);
+    bs.collect();
+    core::Bytes r1 = b1.bvl_raw(), r2 = b2.blob_raw();
+    assert(uintptr_t(r1.data()) % core::Header::raw_align == 0);
+    assert(uintptr_t(r2.data()) % core::Header::raw_align == 0);
+    assert(r1.find(9) == 60 && r2.find(9) == 20 && r2.find(9, 21) == 64);
+    assert(r1.compare(r2) < 0 && r2.compare(r2) == 0);
+    core::Lanes<double> d = r1.lanes<double>();
+    for (size_t k = 0; k < d.size(); k++)
+        d[k] = 0.5 * k;
+    double dsum = 0;
+    for (double x : d)
+        dsum += x;
+    std::cout << "     raw:lanes:" << d.size() << ":" << dsum << "\n";
+    assert(d.size() == 12 && dsum == 33);
+    // A large blob is kept where it is, and so is its filler, before
+    // or behind it; either way the collection moves what it refers to.
+    for (size_t k = 5000; k < 5002; k++) {
+        core::handle_t lb = bs.make_blob(core::headers::blob, k, core::FixInt(0), 8);
+        lb.blob_store(0, bs.cons(core::FixInt(k), bs.null()));
+        uintptr_t lc0 = lb.blob_fetch(0).uint();
+        bs.collect();
+        assert(lb.blob_fetch(0).uint() != lc0 && lb.blob_fetch(0).seq_car().fixint_value() == long(k));
+    }
+
+    // A record is traced by its layout: its raw words stay as they are
+    // (even one that looks like a reference), and its references and
+    // untagged pointers move with their targets.
+    core::Layout *lay = core::Layout::make(40);
+    lay->set(1, core::Layout::nonptr);
+    lay->set(33, core::Layout::closep);
+    spaces::CopySpace rs;
+    core::handle_t rec = rs.make_record(lay);
+    rec.record_store(0, rs.cons(core::FixInt(5), rs.null()));
+    rec.record_set(1, 0x12345);
+    rec.record_store(33, rs.cons(core::FixInt(6), core::FixInt(7)));
+    uintptr_t rec0 = rec.uint();
+    rs.collect();
+    std::cout << "     rcd:slots:" << rec.record_slots() << "\n";
+    assert(rec.is_record() && rec.uint() != rec0);
+    assert(rec.record_fetch(0).seq_car().fixint_value() == 5);
+    assert(rec.record_get(1) == 0x12345);
+    assert(rec.record_fetch(33).pair_cdr().fixint_value() == 7);
+    assert(rec.record_fetch(39).fixint_value() == 0);
+
+    // A narrow vec holds fixnums and literals in half the room, but no
+    // references (see Narrow::fits), so collectors move it, or leave
+    // it, as the bvl it is; it comes back over the wire.
+    spaces::CopySpace ns;
+    core::handle_t nv = ns.make_nvec(3000, core::constants::Literal_true);
+    core::handle_t nlo = ns.cons(core::FixInt(-(intptr_t(1) << 29)), ns.null());
+    nv.nvec_store(1, nlo.seq_car());
+    nv.nvec_store(2, ns.null());
+    uintptr_t nv0 = nv.uint();
+    ns.collect();
+    std::cout << "     nvec:length:" << nv.nvec_length() << "\n";
+    assert(nv.is_nvec() && !nv.is_bvl() && nv.uint() != nv0 && nv.nvec_length() == 3000);
+    assert(nv.nvec_fetch(2999).uint() == core::constants::Literal_true.uint());
+    assert(nv.nvec_fetch(1).fixint_value() == -(intptr_t(1) << 29) && nv.nvec_fetch(2).is_null());
+    assert(!core::Narrow::fits(nlo.uint()) && !core::Narrow::fits(core::FixInt(intptr_t(1) << 29).uint()));
+    spaces::GenSpace ng;
+    core::handle_t gv = ng.make_nvec(3, core::FixInt(-3));
+    ng.collect_minor();
+    gv.nvec_store(2, ng.null());
+    ng.collect_minor();
+    assert(gv.nvec_fetch(2).is_null() && gv.nvec_fetch(0).fixint_value() == -3);
+    spaces::MarkSweepSpace nm;
+    core::handle_t mv = nm.make_nvec(2, core::FixInt(4));
+    nm.collect();
+    nm.cons(core::FixInt(0), nm.null());
+    assert(mv.nvec_fetch(1).fixint_value() == 4);
+    wire::Encoder nenc(nv);
+    spaces::CopySpace nw;
+    wire::Decoder ndec(nw);
+    uintptr_t nchunk[64];
+    while (!nenc.done()) {
+        size_t k = nenc.encode(nchunk, 64);
+        status::status_t ntook = ndec.decode(nchunk, k);
+        assert(ntook.is_success());
+    }
+    assert(ndec.done() && ndec.result().nvec_fetch(1).fixint_value() == -(intptr_t(1) << 29));
+
+    // A pinned bvl stays put through collections, so a read(2) can
+    // fill it in place.
+    spaces::CopySpace ps;
+    core::handle_t buf = ps.make_bvl(core::headers::bvl, 64);
+    int fds[2];
+    int piped = pipe(fds);
+    assert(piped == 0);
+    ssize_t wrote = write(fds[1], "pinned", 6);
+    assert(wrote == 6);
+    {
+        core::Pin pin(ps, buf);
+        uint8_t *at = pin.data();
+        for (int k = 0; k < 100000; k++)
+            ps.cons(core::FixInt(k), ps.null()); // garbage, and collections
+        ps.collect();
+        assert(pin.data() == at && buf.bvl_raw().data() == at);
+        ssize_t got = read(fds[0], pin.data(), pin.size());
+        assert(got == 6);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    ps.collect();
+    std::cout << "     pin:read:" << char(buf.bvl_get(0)) << "\n";
+    assert(buf.bvl_get(0) == 'p' && buf.bvl_get(5) == 'd');
+
+    // An image written from one space maps back into another as it
+    // was, and what is stored into it afterwards is kept alive.
+    FILE *imf = tmpfile();
+    {
+        core::handle_t parts[] = { two, rec, b2 };
+        status::status_t imaged = spaces::Image::write(fileno(imf), parts, 3, &lay, 1);
+        assert(imaged.is_success());
+    }
+    spaces::GenSpace is;
+    {
+        spaces::Image img(is);
+        status::status_t loaded = img.load(fileno(imf), &lay, 1);
+        assert(loaded.is_success() && img.roots() == 3);
+        core::handle_t itwo = img.root(0), irec = img.root(1), iblob = img.root(2);
+        assert(itwo.seq_car().fixint_value() == 2 && itwo.seq_cdr().seq_car().fixint_value() == 3);
+        assert(irec.record_fetch(0).seq_car().fixint_value() == 5);
+        assert(irec.record_fetch(33).pair_cdr().fixint_value() == 7);
+        assert(iblob.blob_raw().find(9) == 20);
+        irec.record_store(0, is.cons(core::FixInt(8), is.null()));
+        is.collect_minor();
+        is.collect();
+        std::cout << "     img:words:" << img.words() << "\n";
+        assert(irec.record_fetch(0).seq_car().fixint_value() == 8);
+    }
+    fclose(imf);
+
+    // A graph goes over the wire a few words at a time, and comes back
+    // with its sharing and its cycle, its conses as one run.
+    spaces::CopySpace ws;
+    core::handle_t wl = ws.cons(core::FixInt(3), ws.null());
+    wl = ws.cons(ws.make_bvl(core::headers::bvl, 5), wl);
+    wl = ws.cons(core::FixInt(1), wl);
+    core::handle_t wv = ws.make_vec(core::headers::vec, 3, wl);
+    wv.vec_store(1, wl.seq_cdr());
+    wv.vec_store(2, wv); // the cycle
+    wl.seq_cdr().seq_car().bvl_raw().fill(0, 5, 'w');
+    wire::Encoder enc(wv);
+    spaces::GenSpace wg(spaces::Policy(1024, 256), 1);
+    wire::Decoder dec(wg);
+    uintptr_t chunk[3];
+    size_t sent = 0;
+    while (!enc.done()) {
+        size_t k = enc.encode(chunk, 3);
+        sent += k;
+        status::status_t took = dec.decode(chunk, k);
+        assert(took.is_success());
+        for (int j = 0; j < 300; j++)
+            wg.cons(core::FixInt(j), wg.null()); // garbage, and collections
+    }
+    assert(dec.done());
+    core::handle_t rv = dec.result();
+    std::cout << "     wire:words:" << sent << "\n";
+    assert(rv.vec_fetch(2).uint() == rv.uint());
+    assert(rv.vec_fetch(0).seq_cdr().uint() == rv.vec_fetch(1).uint());
+    assert(rv.vec_fetch(0).is_snok() && rv.vec_fetch(1).seq_car().bvl_get(4) == 'w');
+    assert(rv.vec_fetch(1).seq_cdr().seq_car().fixint_value() == 3);
+
+    // Threads cons at once in one space, each through a mutator of its
+    // own, stopping one another to collect; one of them parks a while.
+    spaces::SharedSpace ss(spaces::Policy(4096, 1024, 8));
+    std::vector<long> sums(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < sums.size(); t++)
+        threads.push_back(std::thread([&ss, &sums, t] {
+            spaces::Mutator m(ss);
+            core::handle_t l = m.null();
+            for (int r = 0; r < 20; r++) {
+                l = m.null();
+                for (int j = 0; j < 500; j++)
+                    l = m.cons(core::FixInt(j), l);
+                if (t == 0 && r == 10)
+                    m.collect();
+                if (t == 1 && r == 5) {
+                    spaces::Mutator::Parked p(m);
+                    usleep(2000);
+                }
+            }
+            long sum = 0;
+            for (core::handle_t c = l; !c.is_null(); c = c.seq_cdr())
+                sum += c.seq_car().fixint_value();
+            sums[t] = sum;
+        }));
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    ss.collect();
+    std::cout << "   shared:collected:" << (ss.collections() > 1) << "\n";
+    for (size_t t = 0; t < sums.size(); t++)
+        assert(sums[t] == 499 * 500 / 2);
+    assert(ss.mutators() == 0 && ss.words_in_use() == 0);
+
+    // Threads keep lists of their own in shards, collecting each shard
+    // alone, with a shared cell held only from a shard meanwhile; then
+    // share them, and hand them over through a shared root.
+    spaces::SharedSpace hs(spaces::Policy(4096, 1024, 8));
+    spaces::SharedRoot box(hs);
+    {
+        spaces::Mutator m(hs);
+        box.set(m.make_vec(core::headers::vec, 3, core::FixInt(0)));
+    }
+    std::vector<size_t> shard_gcs(3);
+    threads.clear();
+    for (size_t t = 0; t < shard_gcs.size(); t++)
+        threads.push_back(std::thread([&hs, &box, &shard_gcs, t] {
+            spaces::Mutator m(hs);
+            spaces::Shard sh(m, spaces::Policy(4096, 1024, 2));
+            core::handle_t l = sh.cons(m.cons(core::FixInt(t), m.null()), sh.null());
+            for (int r = 0; r < 20; r++) {
+                for (int j = 0; j < 500; j++) {
+                    l = sh.cons(core::FixInt(j), l);
+                    sh.cons(core::FixInt(j), sh.null());
+                    m.cons(core::FixInt(j), m.null());
+                }
+            }
+            l = sh.share(l);
+            box.get(m).vec_store(t, l);
+            shard_gcs[t] = sh.collections();
+        }));
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    {
+        spaces::Mutator m(hs);
+        m.collect();
+        core::handle_t v = box.get(m);
+        for (size_t t = 0; t < shard_gcs.size(); t++) {
+            long sum = 0;
+            core::handle_t c = v.vec_fetch(t);
+            for (; !c.seq_cdr().is_null(); c = c.seq_cdr())
+                sum += c.seq_car().fixint_value();
+            assert(sum == 20 * (499 * 500 / 2));
+            assert(c.seq_car().seq_car().fixint_value() == long(t));
+            assert(shard_gcs[t] > 0);
+        }
+    }
+    std::cout << "    shard:collected:" << (hs.collections() > 1) << "\n";
+
+    // Pairs and vecs hash-consed alike are one object, through
+    // collections that move them, minor ones too, and in a non-moving
+    // space; the tables let go of the dead ones.  Threads interning
+    // through their mutators share one table.
+    spaces::CopySpace xs;
+    core::Interns xt(xs);
+    core::handle_t xl = xs.hcons(core::FixInt(1), xs.hcons(core::FixInt(2), xs.null()));
+    core::Atom xw[2] = { core::FixInt(3), core::FixInt(4) };
+    core::handle_t xv = xs.make_ivec(core::headers::vec, xw, xw + 2);
+    for (int j = 0; j < 100; j++)
+        xs.hcons(core::FixInt(j), xs.null());
+    uintptr_t xl0 = xl.uint();
+    assert(xt.size() == 102);
+    xs.collect();
+    std::cout << "   intern:entries:" << xt.size() << "\n";
+    assert(xt.size() == 3 && xl.uint() != xl0);
+    core::handle_t xl2 = xs.hcons(core::FixInt(1), xs.hcons(core::FixInt(2), xs.null()));
+    core::handle_t xv2 = xs.make_ivec(core::headers::vec, xw, xw + 2);
+    core::handle_t xp2 = xs.make_ivec(core::headers::pair, xw, xw + 2);
+    core::handle_t xc = xs.cons(core::FixInt(1), xl.seq_cdr());
+    core::handle_t xh = xs.hcons(core::FixInt(3), core::FixInt(4));
+    assert(xl2.uint() == xl.uint() && xv2.uint() == xv.uint());
+    assert(xp2.uint() != xv.uint() && xc.uint() != xl.uint() && xh.uint() != xv.uint());
+    spaces::GenSpace xg;
+    core::Interns xgt(xg);
+    core::handle_t xq = xg.hcons(core::FixInt(5), xg.null());
+    xg.collect_minor();
+    core::handle_t xq2 = xg.hcons(core::FixInt(5), xg.null());
+    assert(xq2.uint() == xq.uint());
+    xg.collect();
+    core::handle_t xq3 = xg.hcons(core::FixInt(5), xg.null());
+    assert(xq3.uint() == xq.uint() && xgt.size() == 1);
+    spaces::MarkSweepSpace xm;
+    core::Interns xmt(xm);
+    core::handle_t xy = xm.hcons(core::FixInt(6), xm.null());
+    for (int j = 0; j < 100; j++)
+        xm.hcons(core::FixInt(j + 7), xm.null());
+    xm.collect();
+    assert(xmt.size() == 1);
+    core::handle_t xy2 = xm.hcons(core::FixInt(6), xm.null());
+    assert(xy2.uint() == xy.uint());
+    spaces::SharedSpace xss(spaces::Policy(4096, 1024, 8));
+    core::Interns xst(xss);
+    std::vector<spaces::SharedRoot*> xlists;
+    threads.clear();
+    for (size_t t = 0; t < 3; t++) {
+        xlists.push_back(new spaces::SharedRoot(xss));
+        threads.push_back(std::thread([&xss, &xlists, t] {
+            spaces::Mutator m(xss);
+            core::handle_t l = m.null();
+            for (int j = 0; j < 2000; j++) {
+                l = m.hcons(core::FixInt(j % 500), l);
+                m.cons(core::FixInt(j), m.null());
+            }
+            xlists[t]->set(l);
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    {
+        spaces::Mutator m(xss);
+        m.collect();
+        assert(xst.size() == 2000);
+        for (size_t t = 1; t < xlists.size(); t++)
+            assert(xlists[t]->get(m).uint() == xlists[0]->get(m).uint());
+    }
+    for (size_t t = 0; t < xlists.size(); t++)
+        delete xlists[t];
+
+    // A region scope gives back at once all that was allocated in it,
+    // large objects too.  A value that escapes it is copied out into
+    // the region's parent, and the region's references into the parent
+    // move with their targets.
+    spaces::CopySpace gp;
+    spaces::RegionSpace gr(gp, spaces::Policy(4096, 1024));
+    core::handle_t go = gp.cons(core::FixInt(1), gp.null());
+    core::handle_t gl = gr.null();
+    {
+        spaces::RegionScope sc(gr);
+        for (int j = 0; j < 5000; j++)
+            gr.cons(core::FixInt(j), gr.null());
+        gr.make_vec(core::headers::vec, 2000, core::FixInt(0));
+        assert(gr.words_in_use() >= 10000 && gr.large_units() > 0);
+        {
+            spaces::RegionScope inner(gr);
+            gl = gr.cons(go, gr.null());
+            gl = gr.cons(core::FixInt(2), gl);
+        }
+        assert(gr.promotions() == 2);
+    }
+    std::cout << "   region:promoted:" << gr.promotions() << "\n";
+    assert(gr.words_in_use() == 0 && gr.large_units() == 0);
+    core::handle_t gk = gr.cons(go, gr.null());
+    uintptr_t go0 = go.uint();
+    gp.collect();
+    assert(go.uint() != go0 && gk.seq_car().uint() == go.uint());
+    assert(gl.seq_car().fixint_value() == 2 && gl.seq_cdr().seq_car().uint() == go.uint());
+    spaces::RegionSpace ga;
+    for (int r = 0; r < 3; r++) {
+        spaces::RegionScope sc(ga);
+        core::handle_t v = ga.make_vec(core::headers::vec, 100, core::FixInt(r));
+        assert(v.vec_fetch(99).fixint_value() == r);
+    }
+    assert(ga.words_in_use() == 0);
+
+    // A trace dump reads back as the events recorded.  (The core's own
+    // hooks only record when built with CORE_TRACE=1.)
+    trace::Switch<true>::record(trace::alloc, 0x1000, 2);
+    trace::Switch<true>::record(trace::car, 0x1000, 0);
+    FILE *td = tmpfile();
+    assert(td);
+    bool dumped = trace::dump(td);
+    assert(dumped);
+    rewind(td);
+    FILE *null = fopen("/dev/null", "w");
+    long events = trace::decode(td, null);
+    fclose(null);
+    fclose(td);
+    std::cout << "     trace:events:" << events << "\n";
+    assert(events >= 2);
     return 0;
 }
@@ -0,0 +1,124 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include "trace.h"
+
+// A dump is a FileHeader, then for each thread a RingHeader and its
+// events, oldest first.  Everything is in the writer's byte order; the
+// header's event_size catches a reader built with a different Event.
+
+namespace trace {
+
+    namespace {
+        struct FileHeader {
+            char magic[4];
+            uint32_t version;
+            uint32_t event_size;
+            uint32_t rings;
+        };
+
+        struct RingHeader {
+            uint64_t thread;
+            uint64_t events;   // in this dump
+            uint64_t dropped;  // overwritten before it
+        };
+
+        const char magic[4] = { 'c', 't', 'r', 'c' };
+        const uint32_t version = 1;
+
+        std::atomic<Ring*> rings(0);
+        std::atomic<uint64_t> thread_count(0);
+    }
+
+    thread_local Ring *Ring::current = 0;
+
+    Ring* Ring::make() {
+        Ring *r = new Ring();
+        r->thread = thread_count.fetch_add(1) + 1;
+        r->next = rings.load();
+        while (!rings.compare_exchange_weak(r->next, r))
+            ;
+        current = r;
+        return r;
+    }
+
+    uint64_t Ring::clock_ticks() {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(
+            steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool dump(FILE *out) {
+        FileHeader fh;
+        memcpy(fh.magic, magic, sizeof(magic));
+        fh.version = version;
+        fh.event_size = sizeof(Event);
+        fh.rings = 0;
+        for (Ring *r = rings.load(); r; r = r->next)
+            fh.rings++;
+        if (fwrite(&fh, sizeof(fh), 1, out) != 1)
+            return false;
+
+        // Rings are listed newest first; the thread numbers say which
+        // is which.
+        for (Ring *r = rings.load(); r; r = r->next) {
+            uint64_t n = r->count.load(std::memory_order_acquire);
+            RingHeader rh;
+            rh.thread = r->thread;
+            rh.events = n < Ring::size ? n : Ring::size;
+            rh.dropped = n - rh.events;
+            if (fwrite(&rh, sizeof(rh), 1, out) != 1)
+                return false;
+            // The oldest event kept is at n mod size: write from there
+            // to the end of the array, then from its start.
+            size_t first = size_t(n - rh.events) & (Ring::size - 1);
+            size_t tail = Ring::size - first;
+            if (tail > rh.events)
+                tail = rh.events;
+            if (fwrite(r->events + first, sizeof(Event), tail, out) != tail)
+                return false;
+            size_t head = rh.events - tail;
+            if (fwrite(r->events, sizeof(Event), head, out) != head)
+                return false;
+        }
+        return fflush(out) == 0;
+    }
+
+    long decode(FILE *in, FILE *out) {
+        FileHeader fh;
+        if (fread(&fh, sizeof(fh), 1, in) != 1 ||
+            memcmp(fh.magic, magic, sizeof(magic)) != 0 ||
+            fh.version != version || fh.event_size != sizeof(Event))
+            return -1;
+        long total = 0;
+        for (uint32_t i = 0; i < fh.rings; i++) {
+            RingHeader rh;
+            if (fread(&rh, sizeof(rh), 1, in) != 1)
+                return -1;
+            fprintf(out, "thread %llu: %llu events (%llu dropped)\n",
+                    (unsigned long long) rh.thread,
+                    (unsigned long long) rh.events,
+                    (unsigned long long) rh.dropped);
+            for (uint64_t k = 0; k < rh.events; k++) {
+                Event e;
+                if (fread(&e, sizeof(e), 1, in) != 1)
+                    return -1;
+                fprintf(out, "%20llu %-13s 0x%016llx %u\n",
+                        (unsigned long long) e.time, kind_name(e.kind),
+                        (unsigned long long) e.addr, e.arg);
+                total++;
+            }
+        }
+        return total;
+    }
+
+    const char* kind_name(uint32_t k) {
+        static const char *names[kind_count] = {
+            "alloc", "car", "cdr", "handle_link", "handle_unlink",
+            "local_push", "scope_close"
+        };
+        return k < kind_count ? names[k] : "?";
+    }
+}
@@ -0,0 +1,111 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef TRACE_H_INCLUDED
+#error "trace.h multiply included"
+#endif
+#define TRACE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+
+// Tracing is compiled in with -DCORE_TRACE=1.  Otherwise every
+// trace::record call is an empty inline function, and the hooks in the
+// core cost nothing at all.
+#ifndef CORE_TRACE
+#define CORE_TRACE 0
+#endif
+
+namespace trace {
+
+    enum Kind {
+        alloc,          // addr: the object; arg: its words
+        car,            // addr: the cell read
+        cdr,            // addr: the cell read
+        handle_link,    // addr: the handle
+        handle_unlink,  // addr: the handle
+        local_push,     // addr: the slot
+        scope_close,    // addr: the new top; arg: Locals dropped
+        kind_count
+    };
+
+    // What a trace file holds, one after another for each thread.
+    struct Event {
+        uint64_t time;  // in ticks of the cycle counter, where there is one
+        uint64_t addr;
+        uint32_t kind;
+        uint32_t arg;
+    };
+
+    // The events of one thread, the newest 2^order of them.  Only its
+    // thread writes to a ring, so recording takes no locks and no
+    // atomic read-modify-writes: one slot store, then a release store
+    // of the count, which a dump reads with acquire.
+    class Ring {
+    public:
+        static const unsigned order = 16;
+        static const size_t size = size_t(1) << order;
+
+        // The calling thread's ring, made (and listed for dump) on its
+        // first event.  Rings outlive their threads, so that a dump
+        // still sees what a finished thread did.
+        static Ring* mine() {
+            Ring *r = current;
+            return r ? r : make();
+        }
+
+        void put(Kind k, uintptr_t addr, uint32_t arg) {
+            uint64_t n = this->count.load(std::memory_order_relaxed);
+            Event &e = this->events[n & (size - 1)];
+            e.time = ticks();
+            e.addr = addr;
+            e.kind = k;
+            e.arg = arg;
+            this->count.store(n + 1, std::memory_order_release);
+        }
+
+        static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+            return __builtin_ia32_rdtsc();
+#else
+            return clock_ticks();
+#endif
+        }
+
+    private:
+        Ring() : count(0), next(0), thread(0) {}
+        static Ring* make();
+        static uint64_t clock_ticks();
+        friend bool dump(FILE *out);
+
+        std::atomic<uint64_t> count; // events ever recorded
+        Ring *next;                  // in the list of all rings
+        uint64_t thread;             // numbered in order of first event
+        Event events[size];
+
+        static thread_local Ring *current;
+    };
+
+    template <bool on> struct Switch {
+        static void record(Kind, uintptr_t, uint32_t) {}
+    };
+    template <> struct Switch<true> {
+        static void record(Kind k, uintptr_t addr, uint32_t arg) {
+            Ring::mine()->put(k, addr, arg);
+        }
+    };
+
+    inline void record(Kind k, const void *addr, size_t arg = 0) {
+        Switch<bool(CORE_TRACE)>::record(k, uintptr_t(addr), uint32_t(arg));
+    }
+
+    // Write every ring to out, in the binary format decode reads; best
+    // taken while the traced threads are stopped, since a ring being
+    // written may have its oldest events overwritten as it is copied.
+    bool dump(FILE *out);
+    // Print the events of a dump as text, one per line, each thread's
+    // in order; returns how many there were, or -1 if in is not a dump.
+    long decode(FILE *in, FILE *out);
+
+    const char* kind_name(uint32_t k);
+}
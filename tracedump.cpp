@@ -0,0 +1,26 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include "trace.h"
+
+// Prints a trace dump (see trace::dump) as text: "tracedump FILE", or
+// "tracedump -" for the standard input.
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <dump>\n", argv[0]);
+        return 2;
+    }
+    bool std_in = argv[1][0] == '-' && argv[1][1] == 0;
+    FILE *in = std_in ? stdin : fopen(argv[1], "rb");
+    if (in == 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    long n = trace::decode(in, stdout);
+    if (n < 0) {
+        fprintf(stderr, "%s: not a trace dump\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
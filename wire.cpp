@@ -0,0 +1,440 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cassert>
+
+#include "ctors.h"
+#include "status.h"
+#include "recv.h"
+#include "trace.h"
+#include "core.h"
+#include "spaces.h"
+#include "marksweep.h"
+#include "wire.h"
+
+namespace wire {
+    using core::Word;
+    using core::Header;
+    using core::Layout;
+
+    namespace {
+        core::tagged_t& tagged(uintptr_t &w) { return *(core::tagged_t*) &w; }
+
+        bool is_cell(uintptr_t w) {
+            Word::variant_t v = Word::variant_of(w);
+            return v == Word::konsref || v == Word::snokref;
+        }
+
+        uintptr_t cdr_of(uintptr_t w) { return tagged(w).seq_cdr().uint(); }
+    }
+
+    Encoder::Encoder(core::handle_t const& root,
+                     Layout const *const *layouts, size_t layout_count)
+        : held(root), layouts(layouts), layout_count(layout_count),
+          next(0), staged(0), sent(0), good(true) {
+        Frame f = { Frame::root, 0, root.uint(), 0, 1 };
+        this->stack.push_back(f);
+    }
+
+    size_t Encoder::encode(uintptr_t *buf, size_t n) {
+        size_t k = 0;
+        for (;;) {
+            while (this->sent < this->staged && k < n)
+                buf[k++] = this->out[this->sent++];
+            if (this->sent < this->staged || k == n)
+                return k;
+            this->staged = this->sent = 0;
+            if (this->stack.empty())
+                return k;
+            Frame &f = this->stack.back();
+            if (f.kind != Frame::raw) {
+                this->step();
+                continue;
+            }
+            // Raw words go straight across, as many as fit.
+            size_t m = f.n - f.i < n - k ? f.n - f.i : n - k;
+            memcpy(buf + k, f.p + f.i, m * sizeof(uintptr_t));
+            k += m;
+            f.i += m;
+            if (f.i == f.n)
+                this->stack.pop_back();
+        }
+    }
+
+    // Stage the next item of the innermost object; the frame moves on
+    // (or goes) before value may push another.
+    void Encoder::step() {
+        Frame &f = this->stack.back();
+        switch (f.kind) {
+        case Frame::root: {
+            uintptr_t w = f.w;
+            this->stack.pop_back();
+            this->value(w);
+            return;
+        }
+        case Frame::vec: case Frame::blob: {
+            uintptr_t w = f.p[f.i++];
+            if (f.i == f.n)
+                this->stack.pop_back();
+            this->value(w);
+            return;
+        }
+        case Frame::narrow: {
+            uintptr_t w = core::Narrow::decode(((uint32_t*) f.p)[f.i++]);
+            if (f.i == f.n)
+                this->stack.pop_back();
+            this->value(w);
+            return;
+        }
+        case Frame::record: {
+            Layout const *l = (Layout const*) f.w;
+            size_t j = f.i++;
+            uintptr_t w = f.p[j];
+            if (f.i == f.n)
+                this->stack.pop_back();
+            switch (l->describe(j)) {
+            case Layout::tagged: this->value(w); return;
+            case Layout::closep: if (w) this->value(w | 0x5); else this->stage(0); return;
+            default: this->stage(w); return;
+            }
+        }
+        case Frame::list: {
+            // f.w is the next cell, or after the last car, the cdr.
+            uintptr_t w = f.w;
+            if (f.i++ == f.n) {
+                this->stack.pop_back();
+                this->value(w);
+                return;
+            }
+            f.w = cdr_of(w);
+            this->value(((uintptr_t*) (w & ~0x7))[0]);
+            return;
+        }
+        default:
+            assert(0);
+        }
+    }
+
+    void Encoder::value(uintptr_t w) {
+        if (!(w & 0x1)) { // an atom
+            this->stage(w);
+            return;
+        }
+        uintptr_t *p = (uintptr_t*) (w & ~0x7), *o = p;
+        std::unordered_map<const uintptr_t*, size_t>::iterator s;
+        switch (Word::variant_of(w)) {
+        case Word::konsref: case Word::snokref:
+            s = this->seen.find(p);
+            if (s != this->seen.end()) {
+                this->stage(s->second << 3 | (w & 0x7));
+                return;
+            }
+            {
+                // The list runs on until a cell already numbered.
+                size_t n = 0;
+                for (uintptr_t c = w; is_cell(c) &&
+                         this->seen.insert(std::make_pair((uintptr_t*) (c & ~0x7), this->next)).second;
+                     c = cdr_of(c))
+                    this->next++, n++;
+                this->stage(n << 6 | list_tag);
+                Frame f = { Frame::list, 0, w, 0, n };
+                this->stack.push_back(f);
+            }
+            return;
+        case Word::valref:
+            if (Word::variant_of(p[0]) == Word::blobmdr)
+                o = p - Header::midder_delta(p[0]);
+            break;
+        case Word::intrref:
+            o = spaces::object_containing(p);
+            break;
+        default:
+            assert(0);
+        }
+        if (o != p)
+            this->stage(uintptr_t(p - o) << 9 | (w & 0x7) << 6 | offset_tag);
+        s = this->seen.find(o);
+        if (s != this->seen.end())
+            this->stage(s->second << 3 | 0x5);
+        else
+            this->define(o);
+    }
+
+    // Stage the header and length words of the object at o, and push
+    // what follows them.
+    void Encoder::define(uintptr_t *o) {
+        size_t f = Header::first_value(o);
+        for (size_t i = 0; i < f; i++)
+            this->stage(o[i]);
+        this->seen[o] = this->next++;
+        size_t l = Header::value_words(o);
+        size_t r = (Header::raw_bytes(o) + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+        switch (Word::variant_of(o[0])) {
+        case Word::vechdr:
+            assert(Header::nym_code(o[0]) != core::headers::run.code()); // runs go as lists
+            if (l) {
+                Frame v = { Frame::vec, o + f, 0, 0, l };
+                this->stack.push_back(v);
+            }
+            return;
+        case Word::blobhdr:
+            if (r) {
+                Frame w = { Frame::raw, o + Header::first_raw(o), 0, 0, r };
+                this->stack.push_back(w);
+            }
+            if (l) {
+                Frame v = { Frame::blob, o + f, 0, 0, l };
+                this->stack.push_back(v);
+            }
+            return;
+        case Word::bvlhdr:
+            if (Header::is_record(o[0])) {
+                Layout const *y = Layout::of(o);
+                size_t k = 0;
+                while (k < this->layout_count && this->layouts[k] != y)
+                    k++;
+                this->good = this->good && k < this->layout_count;
+                this->stage(k);
+                if (y->length()) {
+                    Frame v = { Frame::record, Layout::slots(o), uintptr_t(y), 0, y->length() };
+                    this->stack.push_back(v);
+                }
+            } else if (Header::is_nvec(o[0])) {
+                if (size_t n = core::Narrow::length(o)) {
+                    Frame v = { Frame::narrow, o + f, 0, 0, n };
+                    this->stack.push_back(v);
+                }
+            } else if (r) {
+                Frame w = { Frame::raw, o + f, 0, 0, r };
+                this->stack.push_back(w);
+            }
+            return;
+        default:
+            assert(0);
+        }
+    }
+
+    Decoder::Decoder(core::Space &s, Layout const *const *layouts, size_t layout_count)
+        : space(&s), anchor(s.null()), layouts(layouts), layout_count(layout_count),
+          value(core::constants::Literal_void.uint()), have(0), need(0),
+          offset(0), failed(false) {
+        this->push(Frame::root, 0, 1);
+        s.add_region(this);
+    }
+
+    Decoder::~Decoder() { this->space->remove_region(this); }
+
+    core::handle_t Decoder::result() const {
+        assert(this->done());
+        return core::handle_t(this->anchor, *(core::tagged_t*) &this->value);
+    }
+
+    void Decoder::visit_refs(core::RootVisitor &v) {
+        for (size_t i = 0; i < this->table.size(); i++)
+            v.visit(&this->table[i]);
+        v.visit(&this->value);
+    }
+
+    void Decoder::push(Frame::Kind k, size_t index, size_t n) {
+        if (n == 0)
+            return;
+        Frame f = { k, index, 0, n };
+        this->stack.push_back(f);
+    }
+
+    bool Decoder::expects_raw() const {
+        Frame const &f = this->stack.back();
+        if (f.kind == Frame::raw)
+            return true;
+        if (f.kind != Frame::record)
+            return false;
+        uintptr_t w = this->table[f.index];
+        Layout const *l = Layout::of((uintptr_t*) (w & ~0x7));
+        return l->describe(f.i) == Layout::nonptr || l->describe(f.i) == Layout::farptr;
+    }
+
+    status::status_t Decoder::decode(const uintptr_t *buf, size_t n) {
+        size_t k = 0;
+        while (!this->failed && k < n) {
+            if (this->stack.empty()) { // words past the end
+                this->failed = true;
+                break;
+            }
+            if (this->have < this->need) {
+                this->head[this->have++] = buf[k++];
+                if (this->have == this->need)
+                    this->failed = !this->allocate();
+                continue;
+            }
+            Frame &f = this->stack.back();
+            if (f.kind == Frame::raw) {
+                // Straight into the raw bytes, as many words as there are.
+                core::tagged_t &o = this->at(f.index);
+                core::Bytes b = o.is_blob() ? o.blob_raw() : o.bvl_raw();
+                size_t m = f.n - f.i < n - k ? f.n - f.i : n - k;
+                size_t from = f.i * sizeof(uintptr_t), len = m * sizeof(uintptr_t);
+                if (len > b.size() - from)
+                    len = b.size() - from;
+                b.copy(from, core::Bytes((uint8_t*) (buf + k), len), 0, len);
+                k += m;
+                f.i += m;
+                if (f.i == f.n)
+                    this->stack.pop_back();
+                continue;
+            }
+            if (this->expects_raw()) {
+                this->at(f.index).record_set(f.i, buf[k++]);
+                if (++f.i == f.n)
+                    this->stack.pop_back();
+                continue;
+            }
+
+            uintptr_t w = buf[k++];
+            switch (Word::variant_of(w)) {
+            case Word::fixnum: case Word::literal:
+                if (this->offset)
+                    this->failed = true;
+                else
+                    this->deliver(w);
+                break;
+            case Word::blobmdr:
+                if ((w & 0x3f) == offset_tag && !this->offset) {
+                    this->offset = w;
+                } else if ((w & 0x3f) == list_tag && (w >> 6) && !this->offset) {
+                    size_t m = w >> 6, first = this->table.size();
+                    core::handle_t l = this->space->make_list(m, core::FixInt(0));
+                    for (size_t i = 0; i < m; i++)
+                        this->table.push_back(l.uint() + i * sizeof(uintptr_t));
+                    this->deliver(l.uint());
+                    this->push(Frame::list, first, m + 1);
+                } else {
+                    this->failed = true;
+                }
+                break;
+            case Word::vechdr: case Word::blobhdr: case Word::bvlhdr:
+                this->head[0] = w;
+                this->have = 1;
+                this->need = 1 + Header::extension_words(w) + (Header::is_record(w) ? 1 : 0);
+                if (this->have == this->need)
+                    this->failed = !this->allocate();
+                break;
+            default: // a reference back
+                if ((w >> 3) >= this->table.size())
+                    this->failed = true;
+                else
+                    this->deliver(this->table[w >> 3]);
+            }
+        }
+        return this->failed ? status::Status::failure() : status::Status::success();
+    }
+
+    // Allocate the object whose header and words are in head, pass it
+    // on, then make way for its contents.
+    bool Decoder::allocate() {
+        uintptr_t *h = this->head;
+        this->have = this->need = 0;
+        core::nym_t nym = core::nym_t::of_code(Header::nym_code(h[0]));
+        size_t l = Header::value_words(h);
+        size_t r = (Header::raw_bytes(h) + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+        size_t index = this->table.size();
+        switch (Word::variant_of(h[0])) {
+        case Word::vechdr: {
+            if (nym.code() == core::headers::run.code())
+                return false;
+            core::handle_t o = this->space->make_vec(nym, l, core::FixInt(0));
+            this->table.push_back(o.uint());
+            this->deliver(o.uint());
+            this->push(Frame::vec, index, l);
+            return true;
+        }
+        case Word::blobhdr: {
+            core::handle_t o = this->space->make_blob(nym, l, core::FixInt(0), Header::raw_bytes(h));
+            this->table.push_back(o.uint());
+            this->deliver(o.uint());
+            this->push(Frame::raw, index, r);
+            this->push(Frame::blob, index, l);
+            return true;
+        }
+        case Word::bvlhdr: {
+            if (Header::is_nvec(h[0])) {
+                if (Header::raw_bytes(h) % sizeof(uint32_t))
+                    return false;
+                size_t n = Header::raw_bytes(h) / sizeof(uint32_t);
+                core::handle_t o = this->space->make_nvec(n, core::FixInt(0));
+                this->table.push_back(o.uint());
+                this->deliver(o.uint());
+                this->push(Frame::narrow, index, n);
+                return true;
+            }
+            if (!Header::is_record(h[0])) {
+                core::handle_t o = this->space->make_bvl(nym, Header::raw_bytes(h));
+                this->table.push_back(o.uint());
+                this->deliver(o.uint());
+                this->push(Frame::raw, index, r);
+                return true;
+            }
+            uintptr_t k = h[Header::first_value(h)];
+            if (k >= this->layout_count ||
+                (1 + this->layouts[k]->length()) * sizeof(uintptr_t) != Header::raw_bytes(h))
+                return false;
+            core::handle_t o = this->space->make_record(this->layouts[k]);
+            this->table.push_back(o.uint());
+            this->deliver(o.uint());
+            this->push(Frame::record, index, this->layouts[k]->length());
+            return true;
+        }
+        default:
+            assert(0);
+            return false;
+        }
+    }
+
+    // Store x, after any offset word, as the innermost object's next
+    // value.
+    void Decoder::deliver(uintptr_t x) {
+        if (this->offset) {
+            uintptr_t d = this->offset >> 9, tag = (this->offset >> 6) & 0x7;
+            x = ((x & ~uintptr_t(0x7)) + d * sizeof(uintptr_t)) | tag;
+            this->offset = 0;
+        }
+        Frame &f = this->stack.back();
+        core::tagged_t &v = tagged(x);
+        switch (f.kind) {
+        case Frame::root:
+            this->value = x;
+            break;
+        case Frame::vec:
+            this->at(f.index).vec_store(f.i, v);
+            break;
+        case Frame::blob:
+            this->at(f.index).blob_store(f.i, v);
+            break;
+        case Frame::narrow:
+            if (core::Narrow::fits(x))
+                this->at(f.index).nvec_store(f.i, v);
+            else
+                this->failed = true;
+            break;
+        case Frame::record: {
+            core::tagged_t &o = this->at(f.index);
+            if (Layout::of((uintptr_t*) (o.uint() & ~0x7))->describe(f.i) == Layout::tagged)
+                o.record_store(f.i, v);
+            else if (Word::variant_of(x) == Word::valref)
+                o.record_store(f.i, v);
+            else if (x != 0) // a closep holds the address of a header, or 0
+                this->failed = true;
+            break;
+        }
+        case Frame::list:
+            if (f.i + 1 < f.n)
+                this->at(f.index + f.i).pair_setcar(v);
+            else
+                this->at(f.index + f.i - 1).pair_setcdr(v);
+            break;
+        default:
+            assert(0);
+        }
+        if (++f.i == f.n)
+            this->stack.pop_back();
+    }
+}
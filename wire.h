@@ -0,0 +1,131 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef WIRE_H_INCLUDED
+#error "wire.h multiply included"
+#endif
+#define WIRE_H_INCLUDED
+
+#ifndef STATUS_H_INCLUDED
+#error "wire.h requires previous include: status.h"
+#endif
+#ifndef CORE_H_INCLUDED
+#error "wire.h requires previous include: core.h"
+#endif
+
+#include <unordered_map>
+#include <vector>
+
+namespace wire {
+
+    // The wire format carries one value, and the graph of objects it
+    // reaches, as a stream of words in the heap's own tagging scheme:
+    //
+    //   fixnum, literal  : the atom itself
+    //   header           : a new object: its header and length words,
+    //                      then (for a record) its layout's index in a
+    //                      table the two ends share, then its contents
+    //                      in order: values as below (a narrow vec's
+    //                      elements too, widened), raw words as they
+    //                      are (a blob's midder is left out)
+    //   n << 6 | 0x0a    : a new list of n cells, then their n cars,
+    //                      then the cdr of the last
+    //   i << 3 | tag     : the object, or list cell, defined i-th
+    //   d << 9 | tag << 6 | 0x2a :
+    //                      the value that follows (a header or an
+    //                      i << 3 word), referred to d words in, by tag
+    //
+    // Objects and cells are numbered as they are defined, so a graph
+    // goes out with each object once, its sharing and cycles as
+    // back-references.  A run of cells (a chain of conses, or a
+    // cdr-coded run) goes out as one list, up to a cell already sent,
+    // and comes back as one run.  The words are the host's, so both
+    // ends must share a word size and byte order.  Far pointers in
+    // records go as they are.
+    //
+    // Both ends work a bounded buffer at a time.  The encoder reads the
+    // objects in place, so their space must not collect until it is
+    // done; the decoder allocates as the objects arrive, and holds
+    // those it is filling as roots of its space (see core::RootRegion)
+    // meanwhile.
+
+    const uintptr_t list_tag = 0x0a, offset_tag = 0x2a;
+
+    class Encoder {
+    public:
+        Encoder(core::handle_t const& root,
+                core::Layout const *const *layouts = 0, size_t layout_count = 0);
+
+        // Up to n more words of the stream into buf; returns how many.
+        size_t encode(uintptr_t *buf, size_t n);
+        bool done() const { return this->stack.empty() && this->staged == this->sent; }
+        // False once a record's layout is found missing from the table.
+        bool ok() const { return this->good; }
+
+    private:
+        struct Frame {
+            enum Kind { root, vec, blob, raw, record, list, narrow } kind;
+            uintptr_t *p;  // the first of the words to go out
+            uintptr_t w;   // a record's layout; the root; a list's next
+                           // cell, then (after the last car) its cdr
+            size_t i, n;   // the next item, of how many
+        };
+        void step();
+        void value(uintptr_t w);
+        void define(uintptr_t *o);
+        void stage(uintptr_t w) { this->out[this->staged++] = w; }
+
+        core::handle_t held;
+        core::Layout const *const *layouts;
+        size_t layout_count;
+        std::vector<Frame> stack;
+        std::unordered_map<const uintptr_t*, size_t> seen; // object or cell -> index
+        size_t next;
+        uintptr_t out[8]; // words that go out before the encoder moves on
+        size_t staged, sent;
+        bool good;
+
+        NO_COPY_CTOR(Encoder);
+    };
+
+    class Decoder : public core::RootRegion {
+    public:
+        Decoder(core::Space &s,
+                core::Layout const *const *layouts = 0, size_t layout_count = 0);
+        ~Decoder();
+
+        // Take the next n words of the stream; fails (for good) on a
+        // stream that is not well formed.
+        status::status_t decode(const uintptr_t *buf, size_t n);
+        bool done() const { return this->stack.empty() && !this->failed; }
+        // requires: done().
+        core::handle_t result() const;
+
+        virtual void visit_refs(core::RootVisitor &v);
+
+    private:
+        struct Frame {
+            enum Kind { root, vec, blob, raw, record, list, narrow } kind;
+            size_t index;  // of the object, or the list's first cell
+            size_t i, n;
+        };
+        void deliver(uintptr_t x);
+        bool expects_raw() const;
+        bool allocate();
+        void push(Frame::Kind k, size_t index, size_t n);
+        core::tagged_t& at(size_t index) { return *(core::tagged_t*) &this->table[index]; }
+
+        core::Space *space;
+        core::handle_t anchor;
+        core::Layout const *const *layouts;
+        size_t layout_count;
+        std::vector<uintptr_t> table; // every object and cell, by number
+        std::vector<Frame> stack;
+        uintptr_t value;              // the result, once delivered
+        uintptr_t head[4];            // a header and its words, so far
+        size_t have, need;
+        uintptr_t offset;             // the offset word before a value, or 0
+        bool failed;
+
+        NO_COPY_CTOR(Decoder);
+    };
+};
@@ -0,0 +1,170 @@
+/* -*- mode: c++; indent-tabs-mode: nil; -*- */
+
+#ifdef WORDSCAN_H_INCLUDED
+#error "wordscan.h multiply included"
+#endif
+#define WORDSCAN_H_INCLUDED
+
+#ifndef CORE_H_INCLUDED
+#error "wordscan.h requires previous include: core.h"
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+namespace core {
+
+    // Classifying a span of words at once, for walkers of the heap that
+    // only care about its references: those are exactly the words with
+    // the low bit set (see the table below Word::variant()), so a span
+    // reduces to a bitmask of its odd words, found a vector at a time.
+    // Runs of fixnums, literals and headers then cost nothing to skip.
+    //
+    // AVX2 (with -mavx2) takes four words a step and SSE2 two; elsewhere
+    // it falls back to one word at a time.
+
+    // Bit i is set iff p[i] is a reference; requires n <= 64.
+    inline uint64_t ref_mask(const uintptr_t *p, size_t n) {
+        uint64_t m = 0;
+        size_t i = 0;
+#if defined(__AVX2__) && UINTPTR_MAX == UINT64_MAX
+        // Shift each low bit up to the sign bit, and gather those.
+        for (; i + 4 <= n; i += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+            v = _mm256_slli_epi64(v, 63);
+            m |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(v))) << i;
+        }
+#elif defined(__SSE2__) && UINTPTR_MAX == UINT64_MAX
+        for (; i + 2 <= n; i += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+            v = _mm_slli_epi64(v, 63);
+            m |= uint64_t(_mm_movemask_pd(_mm_castsi128_pd(v))) << i;
+        }
+#endif
+        for (; i < n; i++)
+            m |= uint64_t(p[i] & 0x1) << i;
+        return m;
+    }
+
+    // Calls f on the address of each reference in [p, p + n), in order.
+    template <typename F>
+    inline void each_ref(uintptr_t *p, size_t n, F const &f) {
+        for (size_t i = 0; i < n; i += 64) {
+            size_t k = n - i < 64 ? n - i : 64;
+            for (uint64_t m = ref_mask(p + i, k); m; m &= m - 1)
+                f(p + i + __builtin_ctzll(m));
+        }
+    }
+
+    // Records are traced by their layouts (see Layout) 32 slots at a
+    // time: the crumbs of a layout word split into a mask of low bits
+    // and one of high bits, from which a few bitwise operations (and
+    // the ref_mask of the slots) give the slots to visit, without a
+    // branch on any one crumb.
+
+    // The even bits of x, packed into 32 (pext, with -mbmi2).
+    inline uint32_t even_bits(uint64_t x) {
+#if defined(__BMI2__) && UINTPTR_MAX == UINT64_MAX
+        return uint32_t(_pext_u64(x, 0x5555555555555555ull));
+#else
+        x &= 0x5555555555555555ull;
+        x = (x | x >> 1) & 0x3333333333333333ull;
+        x = (x | x >> 2) & 0x0f0f0f0f0f0f0f0full;
+        x = (x | x >> 4) & 0x00ff00ff00ff00ffull;
+        x = (x | x >> 8) & 0x0000ffff0000ffffull;
+        return uint32_t(x | x >> 16);
+#endif
+    }
+
+    // Calls f(slot, false) on the address of each tagged slot in [i, j)
+    // that holds a reference, and f(slot, true) on that of each closep
+    // slot that is not 0, for a record with layout l and slots from s.
+    template <typename F>
+    inline void each_record_ref(uintptr_t *s, Layout const *l,
+                                size_t i, size_t j, F const &f) {
+        for (size_t k = i & ~size_t(31); k < j; k += 32) {
+            size_t n = j - k < 32 ? j - k : 32;
+            uint32_t in = uint32_t(~uint64_t(0) >> (64 - n));
+            if (k < i)
+                in &= ~uint32_t(0) << (i - k);
+            uint64_t c = l->crumb_word(k >> 5);
+            uint32_t lo = even_bits(c), hi = even_bits(c >> 1);
+            uint32_t tagged = ~(lo | hi) & in, closep = lo & ~hi & in;
+            if (tagged)
+                tagged &= uint32_t(ref_mask(s + k, n));
+            for (; tagged; tagged &= tagged - 1)
+                f(s + k + __builtin_ctz(tagged), false);
+            for (; closep; closep &= closep - 1) {
+                uintptr_t *slot = s + k + __builtin_ctz(closep);
+                if (*slot)
+                    f(slot, true);
+            }
+        }
+    }
+
+    // Calls f(slot) on the address of each farptr slot in [i, j) that is
+    // not 0, as above: the slots the record's own space leaves alone.
+    template <typename F>
+    inline void each_far_ref(uintptr_t *s, Layout const *l,
+                             size_t i, size_t j, F const &f) {
+        for (size_t k = i & ~size_t(31); k < j; k += 32) {
+            size_t n = j - k < 32 ? j - k : 32;
+            uint32_t in = uint32_t(~uint64_t(0) >> (64 - n));
+            if (k < i)
+                in &= ~uint32_t(0) << (i - k);
+            uint64_t c = l->crumb_word(k >> 5);
+            for (uint32_t far = even_bits(c) & even_bits(c >> 1) & in; far; far &= far - 1) {
+                uintptr_t *slot = s + k + __builtin_ctz(far);
+                if (*slot)
+                    f(slot);
+            }
+        }
+    }
+
+    // A slot that may hold a reference: a tagged word, or the untagged
+    // address of a header (a closep or farptr slot).  get and set see
+    // the reference as a tagged word.
+    struct Slot {
+        enum Kind { tagged, untagged };
+        Kind kind;
+        void *at;
+
+        uintptr_t get() const {
+            switch (this->kind) {
+            case untagged: return *(uintptr_t*) this->at | 0x5;
+            default:       return *(uintptr_t*) this->at;
+            }
+        }
+        void set(uintptr_t w) const {
+            switch (this->kind) {
+            case untagged: *(uintptr_t*) this->at = w & ~uintptr_t(0x7); break;
+            default:       *(uintptr_t*) this->at = w;
+            }
+        }
+    };
+
+    // Calls f(Slot) on each slot of the object at p (a pair, if p[0] is
+    // no header) that may hold a reference; returns the object's length.
+    template <typename F>
+    inline size_t each_slot(uintptr_t *p, F const &f) {
+        if (!Header::is_header(p[0])) {
+            each_ref(p, 2, [&f](uintptr_t *slot) { f(Slot{Slot::tagged, slot}); });
+            return 2;
+        }
+        if (Header::is_record(p[0])) {
+            Layout const *l = Layout::of(p);
+            uintptr_t *s = Layout::slots(p);
+            each_record_ref(s, l, 0, l->length(), [&f](uintptr_t *slot, bool untagged) {
+                f(Slot{untagged ? Slot::untagged : Slot::tagged, slot});
+            });
+            each_far_ref(s, l, 0, l->length(), [&f](uintptr_t *slot) {
+                f(Slot{Slot::untagged, slot});
+            });
+            return Header::object_words(p);
+        }
+        each_ref(p + Header::first_value(p), Header::value_words(p),
+                 [&f](uintptr_t *slot) { f(Slot{Slot::tagged, slot}); });
+        return Header::object_words(p);
+    }
+}